@@ -18,7 +18,20 @@ uncalled = Extension(
      sources = ["src/mapper.cpp",
                 "src/fast5_pool.cpp",
                 "src/fm_profiler.cpp",
+                "src/fm_index.cpp",
+                "src/fm_trace.cpp",
                 "src/bwa_fmi.cpp", 
+                "src/ref_names.cpp",
+                "src/suffix_sort.cpp",
+                "src/rl_bwt.cpp",
+                "src/occ_table.cpp",
+                "src/packed_array.cpp",
+                "src/sa_cache.cpp",
+                "src/jump_table.cpp",
+                "src/repeat_mask.cpp",
+                "src/huge_pages.cpp",
+                "src/numa.cpp",
+                "src/ref_index.cpp",
                 "src/uncalled.cpp",
                 "src/read_buffer.cpp",
                 "src/params.cpp",
@@ -28,6 +41,7 @@ uncalled = Extension(
                 "src/seed_tracker.cpp", 
                 "src/normalizer.cpp", 
                 "src/kmer_model.cpp", 
+                "src/kmer_probs.cpp",
                 "src/event_detector.cpp", 
                 "src/range.cpp",
                 "src/self_align_ref.cpp"],
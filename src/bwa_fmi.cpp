@@ -26,75 +26,589 @@
 #include <algorithm>
 #include <iomanip>
 #include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <cstdio>
+#include <fstream>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <zlib.h>
 #include "bwa_fmi.hpp"
+#include "suffix_sort.hpp"
 
-BwaFMI::BwaFMI() {
-    loaded_ = false;
-    index_ = NULL;
-    bns_ = NULL;
+//Header of the .ufmi file, followed by the occurrence table blocks and 
+//the bit-packed suffix array samples. Padded so the blocks stay 64-byte aligned
+struct FMIHeader {
+    char magic[8];
+    u64 version, 
+        seq_len, 
+        primary, 
+        L2[ALPH_SIZE+1], 
+        sa_intv, 
+        n_sa, 
+        sa_width,
+        occ_bytes,
+        reserved[3];
+};
+
+static_assert(sizeof(FMIHeader) % 64 == 0, "FMIHeader must keep blocks aligned");
+
+static const char FMI_MAGIC[8] = {'U','N','C','L','F','M','I','\0'};
+static const u64 FMI_VERSION = 2;
+
+BwaFMI::BwaFMI() 
+    : index_(NULL),
+      bns_(NULL),
+      sa_cache_(NULL),
+      huge_mode_(HUGE_NONE),
+      replica_(false),
+      mmap_buf_(NULL),
+      mmap_len_(0),
+      loaded_(false) {}
+
+BwaFMI::BwaFMI(const std::string &prefix, bool use_fmi_file) : BwaFMI() {
+    if (prefix.empty()) return;
+
+    //Sequence info is needed first to check the .ufmi against it
+    bns_ = bns_restore(prefix.c_str());
+    names_ = std::make_shared<const RefNames>(bns_);
+
+    std::string fmi_fname = prefix + FMI_SUFF;
+    if (use_fmi_file && std::ifstream(fmi_fname).good()) {
+        loaded_ = load_fmi_file(fmi_fname, prefix);
+    }
+
+    if (!loaded_) {
+        if (std::ifstream(prefix + ".bwt").good()) {
+            loaded_ = load_bwa(prefix);
+        } else {
+            std::cerr << "Error: no usable FM index found for '" 
+                      << prefix << "'\n";
+        }
+    }
 }
 
-BwaFMI::BwaFMI(const std::string &prefix) {
-    if (prefix.empty()) {
-        loaded_ = false;
-        index_ = NULL;
-        bns_ = NULL;
-    } else {
-        std::string bwt_fname = prefix + ".bwt",
-                    sa_fname = prefix + ".sa";
+bool BwaFMI::load_bwa(const std::string &prefix) {
+    std::string bwt_fname = prefix + ".bwt",
+                sa_fname = prefix + ".sa";
+
+    index_ = bwt_restore_bwt(bwt_fname.c_str());
+    bwt_restore_sa(sa_fname.c_str(), index_);
+
+    //Occurrences are answered by occ_, so bwa's copy isn't needed
+    bool occ_ok = occ_.init(index_);
+    free(index_->bwt);
+    index_->bwt = NULL;
+    if (!occ_ok) return false;
+
+    std::memcpy(L2_, index_->L2, sizeof(L2_));
+    primary_ = index_->primary;
+    seq_len_ = index_->seq_len;
+    sa_intv_ = index_->sa_intv;
+
+    //Row 0 holds bwa's -1 and is handled in sa(), so only text 
+    //positions up to seq_len need to be stored
+    if (!sa_.init(index_->n_sa, PackedArray::bits_needed(seq_len_))) {
+        return false;
+    }
+    for (u64 i = 1; i < index_->n_sa; i++) {
+        sa_.set(i, index_->sa[i]);
+    }
+    free(index_->sa);
+    index_->sa = NULL;
+
+    return true;
+}
+
+bool BwaFMI::load_fmi_file(const std::string &fname, 
+                           const std::string &prefix) {
+    int fd = open(fname.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (u64) st.st_size < sizeof(FMIHeader)) {
+        close(fd);
+        return false;
+    }
+
+    //Shared read-only mapping, so processes on the same host share
+    //one copy of the index through the page cache
+    void *buf = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (buf == MAP_FAILED) {
+        std::cerr << "Error: failed to mmap '" << fname << "'\n";
+        return false;
+    }
+
+    //Sizes are checked before they're used to compute the file size, 
+    //so a corrupt header can't overflow it
+    const FMIHeader *h = (const FMIHeader *) buf;
+    bool valid = 
+        std::memcmp(h->magic, FMI_MAGIC, sizeof(FMI_MAGIC)) == 0 && 
+        h->version == FMI_VERSION &&
+        h->seq_len > 0 && h->primary <= h->seq_len &&
+        h->L2[0] == 0 && h->L2[ALPH_SIZE] == h->seq_len &&
+        h->sa_intv > 0 && (h->sa_intv & (h->sa_intv - 1)) == 0 &&
+        h->n_sa == (h->seq_len + h->sa_intv) / h->sa_intv &&
+        h->sa_width >= PackedArray::bits_needed(h->seq_len) && 
+        h->sa_width <= 64 &&
+        h->occ_bytes == OccTable::byte_size(h->seq_len) &&
+        sizeof(FMIHeader) + h->occ_bytes + 
+            PackedArray::byte_size(h->n_sa, h->sa_width) == (u64) st.st_size;
+
+    if (!valid) {
+        std::cerr << "Error: '" << fname << "' is invalid or out of date\n";
+        munmap(buf, st.st_size);
+        return false;
+    }
+
+    if (!index_matches_ref(prefix, bns_, h->seq_len, h->primary, h->L2)) {
+        std::cerr << "Error: '" << fname << "' was not built from the "
+                  << "current reference, rebuild it with 'uncalled index'\n";
+        munmap(buf, st.st_size);
+        return false;
+    }
+
+    //FM index queries are random access, so don't read ahead
+    madvise(buf, st.st_size, MADV_RANDOM);
+
+    mmap_buf_ = buf;
+    mmap_len_ = st.st_size;
+
+    std::memcpy(L2_, h->L2, sizeof(L2_));
+    primary_ = h->primary;
+    seq_len_ = h->seq_len;
+    sa_intv_ = h->sa_intv;
+
+    const u8 *data = (const u8 *) buf + sizeof(FMIHeader);
+    occ_.init(data, seq_len_, primary_);
+    sa_.init(data + h->occ_bytes, h->n_sa, h->sa_width);
+
+    return true;
+}
 
-        index_ = bwt_restore_bwt(bwt_fname.c_str());
-        bwt_restore_sa(sa_fname.c_str(), index_);
-        bns_ = bns_restore(prefix.c_str());
+bool BwaFMI::build(const u8 *pac, u64 len, u64 sa_intv, u16 threads) {
+    if (len == 0) {
+        std::cerr << "Error: cannot build index of an empty sequence\n";
+        return false;
+    }
+    if (sa_intv == 0 || (sa_intv & (sa_intv - 1)) != 0) {
+        std::cerr << "Error: suffix array interval must be a power of two\n";
+        return false;
+    }
+
+    SuffixSorter sorter(pac, len, threads);
+
+    u64 counts[ALPH_SIZE] = {0, 0, 0, 0};
+    for (u64 i = 0; i < len; i++) {
+        counts[sorter.get_base(i)]++;
+    }
+    L2_[0] = 0;
+    for (u8 c = 0; c < ALPH_SIZE; c++) {
+        L2_[c+1] = L2_[c] + counts[c];
+    }
 
-        loaded_ = true;
+    seq_len_ = len;
+    sa_intv_ = sa_intv;
+    if (!sa_.init((len + sa_intv) / sa_intv, 
+                  PackedArray::bits_needed(len), huge_mode_)) {
+        return false;
     }
+
+    //BWT of every row packed like the text, written by all threads. Row 0
+    //is the empty suffix, which is preceded by the last base
+    std::vector<u8> rows((len + 4) / 4, 0);
+    rows[0] = sorter.get_base(len - 1) << 6;
+
+    u64 primary = 0;
+    sorter.sort([&](u64 row, const u64 *pos, u64 count) {
+        for (u64 i = 0; i < count; i++, row++) {
+            if (pos[i] == 0) {
+                primary = row;
+            } else {
+                u8 c = sorter.get_base(pos[i] - 1);
+                __atomic_fetch_or(&rows[row >> 2], (u8) (c << ((~row & 3) << 1)), 
+                                  __ATOMIC_RELAXED);
+            }
+
+            if ((row & (sa_intv - 1)) == 0) {
+                sa_.set_once(row / sa_intv, pos[i]);
+            }
+        }
+    });
+    primary_ = primary;
+
+    loaded_ = occ_.init_packed(rows.data(), len, primary_, huge_mode_);
+    return loaded_;
+}
+
+bool BwaFMI::save(const std::string &fname) const {
+    FMIHeader h;
+    std::memset(&h, 0, sizeof(h));
+    std::memcpy(h.magic, FMI_MAGIC, sizeof(FMI_MAGIC));
+    h.version = FMI_VERSION;
+    h.seq_len = seq_len_;
+    h.primary = primary_;
+    std::memcpy(h.L2, L2_, sizeof(L2_));
+    h.sa_intv = sa_intv_;
+    h.n_sa = sa_.size();
+    h.sa_width = sa_.width();
+    h.occ_bytes = occ_.byte_size();
+
+    //Write to a temporary file first so a mapped copy is never modified
+    std::string tmp_fname = fname + ".tmp";
+    std::ofstream out(tmp_fname, std::ios::binary);
+    out.write((const char *) &h, sizeof(h));
+    out.write((const char *) occ_.data(), occ_.byte_size());
+    out.write((const char *) sa_.data(), sa_.byte_size());
+    out.close();
+
+    if (!out.good() || rename(tmp_fname.c_str(), fname.c_str()) != 0) {
+        std::cerr << "Error: failed to write '" << fname << "'\n";
+        return false;
+    }
+
+    return true;
 }
 
 void BwaFMI::destroy() {
+    if (replica_) {
+        occ_.destroy();
+        sa_.destroy();
+        names_.reset();
+        loaded_ = false;
+        return;
+    }
+
     if (index_ != NULL) { 
         bwt_destroy(index_);
+        index_ = NULL;
     }
     if (bns_ != NULL) { 
         bns_destroy(bns_);
+        bns_ = NULL;
+    }
+    names_.reset();
+    occ_.destroy();
+    sa_.destroy();
+    if (sa_cache_ != NULL) {
+        sa_cache_->destroy();
+        delete sa_cache_;
+        sa_cache_ = NULL;
+    }
+    if (mmap_buf_ != NULL) {
+        munmap(mmap_buf_, mmap_len_);
+        mmap_buf_ = NULL;
+    }
+    loaded_ = false;
+}
+
+//Row arithmetic is done in 64 bits so start_ - 1 can't wrap for 
+//32-bit ranges
+template <typename T>
+BasicRange<T> BwaFMI::extend(BasicRange<T> r1, u8 base) const {
+    u64 os = occ_.occ(u64(r1.start_) - 1, base),
+        oe = occ_.occ(r1.end_, base);
+    return BasicRange<T>(L2_[base] + os + 1, L2_[base] + oe);
+}
+
+template <typename T>
+void BwaFMI::extend_all(BasicRange<T> r1, BasicRange<T> out[ALPH_SIZE]) const {
+    u64 os[ALPH_SIZE], oe[ALPH_SIZE];
+    occ_.occ4(u64(r1.start_) - 1, os);
+    occ_.occ4(r1.end_, oe);
+    for (u8 b = 0; b < ALPH_SIZE; b++) {
+        out[b] = BasicRange<T>(L2_[b] + os[b] + 1, L2_[b] + oe[b]);
     }
 }
 
+template <typename T>
+void BwaFMI::prefetch_occ(BasicRange<T> r1) const {
+    occ_.prefetch(u64(r1.start_) - 1);
+    occ_.prefetch(r1.end_);
+}
+
 Range BwaFMI::get_neighbor(Range r1, u8 base) const {
-    u64 os, oe;
-    bwt_2occ(index_, r1.start_ - 1, r1.end_, base, &os, &oe);
-    return Range(index_->L2[base] + os + 1, index_->L2[base] + oe);
+    return extend(r1, base);
+}
+
+Range32 BwaFMI::get_neighbor(Range32 r1, u8 base) const {
+    return extend(r1, base);
+}
+
+void BwaFMI::get_neighbors(Range r1, Range out[ALPH_SIZE]) const {
+    extend_all(r1, out);
+}
+
+void BwaFMI::get_neighbors(Range32 r1, Range32 out[ALPH_SIZE]) const {
+    extend_all(r1, out);
+}
+
+void BwaFMI::prefetch(Range r1) const {
+    prefetch_occ(r1);
+}
+
+void BwaFMI::prefetch(Range32 r1) const {
+    prefetch_occ(r1);
 }
 
 Range BwaFMI::get_full_range(u8 base) const {
-    return Range(index_->L2[base], index_->L2[base+1]);
+    return Range(L2_[base], L2_[base+1]);
+}
+
+//LF-mapping, same as bwa's bwt_invPsi
+u64 BwaFMI::inv_psi(u64 k) const {
+    if (k == primary_) return 0;
+    u8 c = occ_.get_base(k);
+    return L2_[c] + occ_.occ(k, c);
+}
+
+u8 BwaFMI::bwt_base(u64 k) const {
+    if (k == primary_) return ALPH_SIZE;
+    return occ_.get_base(k);
 }
 
 u64 BwaFMI::sa(u64 i) const {
-    return bwt_sa(index_, i);
+    if (sa_cache_ == NULL || (i & (sa_intv_ - 1)) == 0) {
+        return locate(i);
+    }
+
+    u64 loc;
+    if (!sa_cache_->get(i, loc)) {
+        loc = locate(i);
+        sa_cache_->put(i, loc);
+    }
+    return loc;
+}
+
+u64 BwaFMI::locate(u64 i) const {
+    u64 steps = 0, mask = sa_intv_ - 1;
+    while (i & mask) {
+        steps++;
+        i = inv_psi(i);
+    }
+    if (i == 0) return steps - 1;
+    return steps + sa_.get(i / sa_intv_);
+}
+
+//Samples every intv rows, either from the current samples or by 
+//walking the LF-mapping once over the whole text
+bool BwaFMI::sample_sa(u64 intv, PackedArray &samples) const {
+    u64 n_sa = (seq_len_ + intv) / intv;
+    if (!samples.init(n_sa, sa_.width(), huge_mode_)) return false;
+
+    if (intv % sa_intv_ == 0) {
+        u64 step = intv / sa_intv_;
+        for (u64 i = 1; i < n_sa; i++) {
+            samples.set(i, sa_.get(i * step));
+        }
+        return true;
+    }
+
+    u64 mask = intv - 1, k = 0;
+    for (u64 pos = seq_len_; pos > 0; pos--) {
+        k = inv_psi(k);
+        if ((k & mask) == 0) samples.set(k / intv, pos - 1);
+    }
+
+    return true;
+}
+
+bool BwaFMI::set_sa_intv(u64 intv) {
+    if (intv == 0 || (intv & (intv - 1)) != 0) {
+        std::cerr << "Error: suffix array interval must be a power of two\n";
+        return false;
+    }
+    if (intv == sa_intv_) return true;
+
+    PackedArray samples;
+    if (!sample_sa(intv, samples)) return false;
+
+    sa_.destroy();
+    sa_ = samples;
+    sa_intv_ = intv;
+
+    return true;
+}
+
+bool BwaFMI::init_sa_cache(u64 max_bytes) {
+    if (sa_cache_ != NULL) {
+        sa_cache_->destroy();
+        delete sa_cache_;
+        sa_cache_ = NULL;
+    }
+
+    SACache *cache = new SACache();
+    if (!cache->init(max_bytes, seq_len_)) {
+        delete cache;
+        return false;
+    }
+    sa_cache_ = cache;
+    return true;
+}
+
+const SACache *BwaFMI::get_sa_cache() const {
+    return sa_cache_;
+}
+
+HugePageMode BwaFMI::move_to(HugePageMode mode, i32 node) {
+    huge_mode_ = mode;
+
+    HugePageMode occ_mode = occ_.move_to(mode, node),
+                 sa_mode = sa_.move_to(mode, node);
+
+    if (mmap_buf_ != NULL) {
+        munmap(mmap_buf_, mmap_len_);
+        mmap_buf_ = NULL;
+    }
+
+    return occ_mode < sa_mode ? occ_mode : sa_mode;
+}
+
+FMIndex *BwaFMI::replicate(HugePageMode mode, u32 node, 
+                           HugePageMode *used) const {
+    BwaFMI *dst = new BwaFMI(*this);
+    dst->replica_ = true;
+    dst->huge_mode_ = mode;
+    dst->mmap_buf_ = NULL;
+    dst->mmap_len_ = 0;
+    dst->occ_ = OccTable();
+    dst->sa_ = PackedArray();
+
+    HugePageMode occ_mode, sa_mode;
+    if (!occ_.copy(dst->occ_, mode, node, &occ_mode)) {
+        delete dst;
+        return NULL;
+    }
+    if (!sa_.copy(dst->sa_, mode, node, &sa_mode)) {
+        dst->occ_.destroy();
+        delete dst;
+        return NULL;
+    }
+
+    if (used != NULL) *used = occ_mode < sa_mode ? occ_mode : sa_mode;
+    return dst;
+}
+
+u64 BwaFMI::get_sa_intv() const {
+    return sa_intv_;
+}
+
+u64 BwaFMI::sa_bytes() const {
+    return sa_.byte_size();
 }
 
 u64 BwaFMI::size() const {
-    return index_->seq_len;
+    return seq_len_;
+}
+
+u64 BwaFMI::byte_size() const {
+    return occ_.byte_size() + sa_.byte_size();
+}
+
+bool BwaFMI::is_double_stranded() const {
+    return bns_ == NULL || 2 * u64(bns_->l_pac) == seq_len_;
+}
+
+bool BwaFMI::is_loaded() const {
+    return loaded_;
+}
+
+bool BwaFMI::is_mapped() const {
+    return mmap_buf_ != NULL;
 }
 
-u64 BwaFMI::translate_loc(u64 sa_loc, std::string &ref_name, u64 &ref_loc) const {
-    i32 rid = bns_pos2rid(bns_, sa_loc);
-    if (rid < 0) return 0;
+bool index_matches_ref(const std::string &prefix, const bntseq_t *bns,
+                       u64 seq_len, u64 primary, 
+                       const u64 L2[ALPH_SIZE+1]) {
+    if (bns == NULL) return false;
+
+    u64 l_pac = bns->l_pac;
+    bool double_stranded = seq_len == 2 * l_pac;
+    if (!double_stranded && seq_len != l_pac) return false;
+
+    //"bwa index" stores the primary row and base counts in the .bwt header
+    std::ifstream bwt_in(prefix + ".bwt", std::ios::binary);
+    if (bwt_in.good()) {
+        u64 bwt_primary, bwt_L2[ALPH_SIZE];
+        bwt_in.read((char *) &bwt_primary, sizeof(bwt_primary));
+        bwt_in.read((char *) bwt_L2, sizeof(bwt_L2));
+        if (!bwt_in.good()) return false;
+        return bwt_primary == primary && 
+               std::equal(bwt_L2, bwt_L2 + ALPH_SIZE, L2 + 1);
+    }
+
+    //Otherwise count the forward strand bases, whose reverse complement 
+    //adds the complementary counts to a double-stranded index
+    std::ifstream pac_in(prefix + ".pac", std::ios::binary);
+    if (!pac_in.good()) return false;
+
+    u64 counts[ALPH_SIZE] = {0, 0, 0, 0};
+    std::vector<u8> buf(1 << 20);
+    for (u64 i = 0; i < l_pac; ) {
+        u64 n = std::min<u64>(buf.size(), (l_pac - i + 3) / 4);
+        pac_in.read((char *) buf.data(), n);
+        if (!pac_in.good()) return false;
+
+        for (u64 j = 0; j < n && i < l_pac; j++) {
+            for (u8 k = 0; k < 4 && i < l_pac; k++, i++) {
+                counts[(buf[j] >> ((3 - k) << 1)) & 3]++;
+            }
+        }
+    }
+
+    for (u8 c = 0; c < ALPH_SIZE; c++) {
+        u64 n = counts[c];
+        if (double_stranded) n += counts[ALPH_SIZE - 1 - c];
+        if (L2[c+1] - L2[c] != n) return false;
+    }
+
+    return true;
+}
 
-    ref_name = std::string(bns_->anns[rid].name);
-    ref_loc = sa_loc - bns_->anns[rid].offset;
-    return bns_->anns[rid].len;
+bool write_fmi(const std::string &bwa_prefix, u64 sa_intv) {
+    BwaFMI fmi(bwa_prefix, false);
+    bool ret = fmi.is_loaded() &&
+               (sa_intv == 0 || fmi.set_sa_intv(sa_intv)) &&
+               fmi.save(bwa_prefix + FMI_SUFF);
+    fmi.destroy();
+    return ret;
 }
 
-std::vector< std::pair<std::string, u64> > BwaFMI::get_seqs() const {
-    std::vector< std::pair<std::string, u64> > seqs;
+bool build_fmi(const std::string &fasta_fname, const std::string &prefix, 
+               u64 sa_intv, u16 threads, bool forward_only) {
+
+    //Like "bwa index", pack both strands to build the index, then rewrite
+    //the sequence files with only the forward strand for bns_restore. A
+    //forward-only index is built from the files written the first time
+    gzFile fasta_in = gzopen(fasta_fname.c_str(), "r");
+    if (fasta_in == NULL) {
+        std::cerr << "Error: failed to open '" << fasta_fname << "'\n";
+        return false;
+    }
+    u64 len = bns_fasta2bntseq(fasta_in, prefix.c_str(), forward_only);
+    gzclose(fasta_in);
+
+    std::vector<u8> pac((len + 3) / 4);
+    std::ifstream pac_in(prefix + ".pac", std::ios::binary);
+    pac_in.read((char *) pac.data(), pac.size());
+    if (!pac_in.good()) {
+        std::cerr << "Error: failed to read '" << prefix << ".pac'\n";
+        return false;
+    }
+    pac_in.close();
 
-    for (i32 i = 0; i < bns_->n_seqs; i++) {
-        bntann1_t ann = bns_->anns[i];
-        std::string name = std::string(ann.name);
-        seqs.push_back( std::pair<std::string, u64>(name, ann.len) );
+    if (!forward_only) {
+        fasta_in = gzopen(fasta_fname.c_str(), "r");
+        bns_fasta2bntseq(fasta_in, prefix.c_str(), 1);
+        gzclose(fasta_in);
     }
 
-    return seqs;
+    BwaFMI fmi;
+    bool ret = fmi.build(pac.data(), len, sa_intv, threads) &&
+               fmi.save(prefix + FMI_SUFF);
+    fmi.destroy();
+    return ret;
 }
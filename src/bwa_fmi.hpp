@@ -29,32 +29,125 @@
 #include <utility>
 #include "util.hpp"
 #include "range.hpp"
+#include "fm_index.hpp"
+#include "occ_table.hpp"
+#include "packed_array.hpp"
+#include "sa_cache.hpp"
+#include "ref_names.hpp"
 #include "bwa/bwt.h"
 #include "bwa/bntseq.h"
 
-class BwaFMI {
+#define FMI_SUFF ".ufmi"
+
+//FM index with an uncompressed occurrence table and the suffix array 
+//sampled every sa_intv rows, read from a bwa index or <prefix>.ufmi
+class BwaFMI final : public FMIndex {
     public:
 
     BwaFMI();
-    BwaFMI(const std::string &prefix);
+
+    //Loads <prefix>.ufmi with mmap if it exists and use_fmi_file is set,
+    //otherwise reads the bwa .bwt and .sa files into memory
+    BwaFMI(const std::string &prefix, bool use_fmi_file = true);
+
     void destroy();
 
+    //Builds the index of a text packed 2 bits per base in bwa's .pac 
+    //layout by suffix sorting on the given number of threads. The suffix
+    //array is sampled every sa_intv rows, which must be a power of two
+    bool build(const u8 *pac, u64 len, u64 sa_intv, u16 threads);
+
+    //Writes the index in the mmap-able format read by the constructor
+    bool save(const std::string &fname) const;
+
     Range get_neighbor(Range range, u8 base) const;
+    Range32 get_neighbor(Range32 range, u8 base) const;
+
+    void get_neighbors(Range range, Range out[ALPH_SIZE]) const;
+    void get_neighbors(Range32 range, Range32 out[ALPH_SIZE]) const;
+
+    void prefetch(Range range) const;
+    void prefetch(Range32 range) const;
 
     Range get_full_range(u8 base) const;
 
     u64 sa(u64 i) const;
 
-    u64 size() const;
+    //BWT base at row k, or 4 for the primary row
+    u8 bwt_base(u64 k) const;
+
+    //Replaces the suffix array samples with one sample every intv rows.
+    //intv must be a power of two, and 1 stores the full suffix array
+    bool set_sa_intv(u64 intv);
+    u64 get_sa_intv() const;
+    u64 sa_bytes() const;
 
-    u64 translate_loc(u64 sa_loc, std::string &ref_name, u64 &ref_loc) const;
+    //Caches positions that need LF steps to locate, shared by all threads
+    bool init_sa_cache(u64 max_bytes);
+    const SACache *get_sa_cache() const;
+
+    //Copies the occurrence table and suffix array
+    HugePageMode move_to(HugePageMode mode, i32 node = NUMA_ANY);
+    FMIndex *replicate(HugePageMode mode, u32 node, 
+                       HugePageMode *used = NULL) const;
+
+    u64 size() const;
+    u64 byte_size() const;
 
-    std::vector< std::pair<std::string, u64> > get_seqs() const;
+    bool is_loaded() const;
+    bool is_mapped() const;
+    bool is_double_stranded() const;
 
     private:
+    bool load_bwa(const std::string &prefix);
+    bool load_fmi_file(const std::string &fname, const std::string &prefix);
+
+    template <typename T>
+    BasicRange<T> extend(BasicRange<T> range, u8 base) const;
+
+    template <typename T>
+    void extend_all(BasicRange<T> range, BasicRange<T> out[ALPH_SIZE]) const;
+
+    template <typename T>
+    void prefetch_occ(BasicRange<T> range) const;
+
+    u64 inv_psi(u64 k) const;
+    u64 locate(u64 i) const;
+
+    bool sample_sa(u64 intv, PackedArray &samples) const;
+
     bwt_t *index_;
     bntseq_t *bns_;
+    OccTable occ_;
+
+    u64 L2_[ALPH_SIZE+1], primary_, seq_len_, sa_intv_;
+    PackedArray sa_;
+    SACache *sa_cache_;
+    HugePageMode huge_mode_;
+    bool replica_;
+
+    void *mmap_buf_;
+    u64 mmap_len_;
+
     bool loaded_;
 };
 
+//Checks that an index with the given size, primary row and base counts was
+//built from the reference at prefix. Compared with the bwa .bwt header if 
+//present, otherwise with the bases stored in the .pac file
+bool index_matches_ref(const std::string &prefix, const bntseq_t *bns,
+                       u64 seq_len, u64 primary, 
+                       const u64 L2[ALPH_SIZE+1]);
+
+//Converts a bwa index into <prefix>.ufmi, optionally changing the 
+//suffix array sampling interval (0 keeps bwa's)
+bool write_fmi(const std::string &bwa_prefix, u64 sa_intv = 0);
+
+//Builds <prefix>.ufmi and the bwa sequence files read with it (.pac, .ann
+//and .amb) directly from a FASTA file, without running "bwa index". If
+//forward_only is set the reverse complement isn't indexed, which halves
+//the index but only maps reads from the reverse strand
+bool build_fmi(const std::string &fasta_fname, const std::string &prefix, 
+               u64 sa_intv, u16 threads, bool forward_only = false);
+
 #endif
@@ -195,6 +195,11 @@ void ChunkPool::stop_all() {
         t.running_ = false;
         t.thread_.join();
     }
+
+    const SACache *sa_cache = INDEX_REGISTRY.get()->fmi->get_sa_cache();
+    if (sa_cache != NULL) {
+        sa_cache->print_stats(std::cerr);
+    }
 }
 
 u16 ChunkPool::MapperThread::num_threads = 0;
@@ -225,6 +230,12 @@ void ChunkPool::MapperThread::run() {
 
     std::vector<u16> finished;
 
+    i32 node = PARAMS.thread_node(tid_);
+    if (node != NUMA_ANY && !numa_pin_thread(node)) {
+        std::cerr << "Warning: failed to pin thread " << tid_ 
+                  << " to NUMA node " << node << "\n";
+    }
+
     while (running_) {
         if (read_count() == 0) {
             std::this_thread::sleep_for(std::chrono::milliseconds(10));
@@ -238,6 +249,7 @@ void ChunkPool::MapperThread::run() {
             in_mtx_.unlock();
 
             for (auto ch : in_tmp_) {
+                mappers_[ch].set_thread(tid_);
                 active_chs_.push_back(ch);
             }
 
@@ -106,6 +106,10 @@ void Fast5Pool::stop_all() {
     #ifdef FM_PROFILER
     prof_combined.write("query_counts.bed");
     #endif
+    const SACache *sa_cache = INDEX_REGISTRY.get()->fmi->get_sa_cache();
+    if (sa_cache != NULL) {
+        sa_cache->print_stats(std::cerr);
+    }
 }
 
 u16 Fast5Pool::MapperThread::THREAD_COUNT = 0;
@@ -133,6 +137,13 @@ void Fast5Pool::MapperThread::start() {
 }
 
 void Fast5Pool::MapperThread::run() {
+    i32 node = PARAMS.thread_node(tid_);
+    if (node != NUMA_ANY && !numa_pin_thread(node)) {
+        std::cerr << "Warning: failed to pin thread " << tid_ 
+                  << " to NUMA node " << node << "\n";
+    }
+    mapper_.set_thread(tid_);
+
     while (running_) {
 
         while (!in_buffered_ && running_) {
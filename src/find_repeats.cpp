@@ -23,48 +23,20 @@
 
 #include <iostream>
 #include <string>
-#include <list>
 #include <cstdlib>
-#include "range.hpp"
-#include "bwa_fmi.hpp"
-#include "timer.hpp"
-#include "self_align_ref.hpp"
+#include "repeat_mask.hpp"
 
+//Writes <bwa_prefix>.urep, the same as "uncalled index --repeat-len"
 int main(int argc, char** argv) {
-    std::string bwa_prefix(argv[1]),
-                fasta_fname(argv[2]);
-    u32 min_k = atoi(argv[3]);
-
-    BwaFMI fmi(bwa_prefix);
-
-    std::vector< std::vector<u8> > seqs;
-    std::ifstream fasta_in(fasta_fname);
-    std::string fasta_line;
-    while (getline(fasta_in, fasta_line)) {
-        if (fasta_line[0] == '>') {
-            seqs.push_back(std::vector<u8>());
-        } else {
-            for (char c : fasta_line) {
-                seqs.back().push_back(BASE_COMP_B[BASE_BYTES[(u8)c]]);
-            }
-        }
+    if (argc < 4) {
+        std::cerr << "Usage: find_repeats <bwa_prefix> <fasta> <min_len> [threads]\n";
+        return 1;
     }
 
-    for (auto bases : seqs) {
-        for (u64 i = 0; i < bases.size(); i++) {
-            Range r = fmi.get_full_range(bases[i]);
-            u64 j = i+1;
-            for (; j < bases.size() && r.length() > 1; j++) {
-                r = fmi.get_neighbor(r, bases[j]);
-            }
-            j--;
+    std::string bwa_prefix(argv[1]),
+                fasta_fname(argv[2]);
+    u32 min_len = atoi(argv[3]);
+    u16 threads = argc > 4 ? atoi(argv[4]) : 1;
 
-            if (j-i >= min_k) {
-                std::cout << (j-i) << "\t" << i << "\t" << j << "\t";
-                for (u32 l = i; l < j; l++) std::cout << BASE_CHARS[BASE_COMP_B[bases[l]]];
-                std::cout << "\n";
-            }
-        }
-    }
+    return write_repeat_mask(bwa_prefix, fasta_fname, min_len, threads) ? 0 : 1;
 }
-
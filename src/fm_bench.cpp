@@ -0,0 +1,153 @@
+/* MIT License
+ *
+ * Copyright (c) 2018 Sam Kovaka <skovaka@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <cstdlib>
+#include "fm_trace.hpp"
+#include "bwa_fmi.hpp"
+#include "rl_bwt.hpp"
+#include "timer.hpp"
+
+static const char *QUERY_NAMES[FMQuery::TYPE_COUNT] = 
+    {"get_neighbor", "get_neighbors", "sa"};
+
+//Replays queries of one type in their recorded order, returning the time
+//taken in milliseconds and adding up the results in checksum
+static double replay(const FMIndex &fmi, const std::vector<FMQuery> &queries,
+                     u64 &checksum) {
+    std::vector<u64> locs;
+    Range out[ALPH_SIZE];
+    Timer t;
+
+    for (const FMQuery &q : queries) {
+        Range r(q.start, q.end);
+        switch (q.type) {
+        case FMQuery::NEIGHBOR:
+            r = fmi.get_neighbor(r, q.base);
+            checksum += r.start_ * 31 + r.end_;
+            break;
+        case FMQuery::NEIGHBORS:
+            fmi.get_neighbors(r, out);
+            for (u8 b = 0; b < ALPH_SIZE; b++) {
+                checksum += out[b].start_ * 31 + out[b].end_;
+            }
+            break;
+        default:
+            locs.resize(q.end - q.start + 1);
+            fmi.sa_range(q.start, q.end, locs.data());
+            for (u64 l : locs) checksum += l;
+            break;
+        }
+    }
+
+    return t.get();
+}
+
+//Replays a trace recorded with FM_TRACE against each index layout found 
+//for the prefix, and checks they all give the same results
+int main(int argc, char** argv) {
+    if (argc < 3) {
+        std::cerr << "Usage: fm_bench <bwa_prefix> <trace> [repeats]\n";
+        return 1;
+    }
+
+    std::string prefix(argv[1]);
+    u32 repeats = argc > 3 ? atoi(argv[3]) : 1;
+
+    std::vector<FMQuery> queries;
+    if (!read_fm_trace(argv[2], queries)) {
+        std::cerr << "Error: failed to read '" << argv[2] << "'\n";
+        return 1;
+    }
+
+    std::vector<FMQuery> by_type[FMQuery::TYPE_COUNT];
+    for (const FMQuery &q : queries) {
+        if (q.type < FMQuery::TYPE_COUNT) by_type[q.type].push_back(q);
+    }
+    std::cerr << "Replaying " << queries.size() << " queries\n";
+    std::vector<FMQuery>().swap(queries);
+
+    std::vector< std::pair<std::string, FMIndex *> > backends;
+    backends.push_back(std::make_pair("bwa", new BwaFMI(prefix)));
+    if (std::ifstream(prefix + RLBWT_SUFF).good()) {
+        backends.push_back(std::make_pair("rlbwt", new RunLengthBWT(prefix)));
+    }
+
+    //Results of the first repeat of each query type, per backend
+    u64 expected[FMQuery::TYPE_COUNT];
+    bool checked = false, same = true;
+
+    for (auto &backend : backends) {
+        FMIndex *fmi = backend.second;
+        if (!fmi->is_loaded()) {
+            std::cerr << "Error: failed to load " << backend.first << " index\n";
+            delete fmi;
+            continue;
+        }
+
+        std::cout << backend.first << "\t" 
+                  << (fmi->byte_size() >> 20) << " MB\n";
+
+        for (u32 t = 0; t < FMQuery::TYPE_COUNT; t++) {
+            if (by_type[t].empty()) continue;
+
+            u64 checksum = 0;
+            double time = 0;
+            for (u32 r = 0; r < repeats; r++) {
+                u64 repeat_sum = 0;
+                time += replay(*fmi, by_type[t], repeat_sum);
+                if (r == 0) checksum = repeat_sum;
+            }
+
+            if (!checked) {
+                expected[t] = checksum;
+            } else if (checksum != expected[t]) {
+                std::cerr << "Error: " << backend.first << " gave different "
+                          << QUERY_NAMES[t] << " results\n";
+                same = false;
+            }
+
+            std::cout << "  " << std::setw(14) << std::left << QUERY_NAMES[t]
+                      << std::setw(12) << by_type[t].size()
+                      << std::fixed << std::setprecision(1) 
+                      << (1e6 * time / repeats / by_type[t].size()) 
+                      << " ns/query\n";
+        }
+
+        checked = true;
+
+        fmi->destroy();
+        delete fmi;
+    }
+
+    if (!same) {
+        std::cerr << "Error: index layouts gave different results\n";
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,148 @@
+/* MIT License
+ *
+ * Copyright (c) 2018 Sam Kovaka <skovaka@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include <iostream>
+#include <fstream>
+#include "fm_index.hpp"
+#include "bwa_fmi.hpp"
+#include "rl_bwt.hpp"
+
+void FMIndex::sa_range(u64 st, u64 en, u64 *locs) const {
+    for (u64 i = st; i <= en; i++) {
+        locs[i - st] = sa(i);
+    }
+}
+
+u64 FMIndex::get_sa_intv() const {
+    return 0;
+}
+
+bool FMIndex::set_sa_intv(u64 intv) {
+    std::cerr << "Error: index does not sample the suffix array by row, "
+              << "suffix array interval can't be changed\n";
+    return false;
+}
+
+bool FMIndex::init_sa_cache(u64 max_bytes) {
+    return false;
+}
+
+const SACache *FMIndex::get_sa_cache() const {
+    return NULL;
+}
+
+const RefNames::Ptr &FMIndex::get_names() const {
+    return names_;
+}
+
+std::vector< std::pair<std::string, u64> > FMIndex::get_seqs() const {
+    std::vector< std::pair<std::string, u64> > seqs;
+
+    for (u32 i = 0; i < names_->size(); i++) {
+        seqs.push_back( std::pair<std::string, u64>(names_->get_name(i), 
+                                                    names_->get_len(i)) );
+    }
+
+    return seqs;
+}
+
+//Sequence content hashed into the checksum: the range of every k-mer of
+//this length, and suffix array entries at evenly spaced rows
+static const u8 CHECKSUM_KMER_LEN = 6;
+static const u64 CHECKSUM_SA_SAMPLES = 64;
+
+u64 index_checksum(const FMIndex &fmi) {
+    u64 h = 14695981039346656037ull;
+    auto add = [&h](const void *data, u64 len) {
+        for (u64 i = 0; i < len; i++) {
+            h = (h ^ ((const u8 *) data)[i]) * 1099511628211ull;
+        }
+    };
+
+    u64 vals[2] = {fmi.size(), fmi.is_double_stranded()};
+    add(vals, sizeof(vals));
+    for (u8 b = 0; b < ALPH_SIZE; b++) {
+        Range r = fmi.get_full_range(b);
+        add(&r, sizeof(r));
+    }
+
+    RefNames::Ptr names = fmi.get_names();
+    for (u32 i = 0; names && i < names->size(); i++) {
+        const std::string &name = names->get_name(i);
+        u64 len = names->get_len(i);
+        add(name.c_str(), name.size() + 1);
+        add(&len, sizeof(len));
+    }
+
+    //K-mers in id order, extended to the left from the first base. Empty
+    //ranges are represented differently by each index layout
+    const u8 k = CHECKSUM_KMER_LEN;
+    for (u64 id = 0; id < (1ull << (2 * k)); id++) {
+        Range r = fmi.get_full_range((id >> (2 * k - 2)) & 0x3);
+        for (u8 i = 1; i < k; i++) {
+            r = fmi.get_neighbor(r, (id >> (2 * (k - i - 1))) & 0x3);
+        }
+
+        u64 bounds[2] = {0, 0};
+        if (r.is_valid()) {
+            bounds[0] = r.start_;
+            bounds[1] = r.end_;
+        }
+        add(bounds, sizeof(bounds));
+    }
+
+    //Row 0 is the empty suffix, which isn't located
+    for (u64 i = 0; i < CHECKSUM_SA_SAMPLES; i++) {
+        u64 loc = fmi.sa(1 + i * (fmi.size() - 1) / CHECKSUM_SA_SAMPLES);
+        add(&loc, sizeof(loc));
+    }
+
+    return h;
+}
+
+FMIndex *load_fm_index(const std::string &prefix) {
+    FMIndex *fmi = NULL;
+
+    //A stale r-index is rejected, falling back to the FM index
+    std::ifstream rl_test(prefix + RLBWT_SUFF);
+    if (rl_test.good()) {
+        fmi = new RunLengthBWT(prefix);
+        if (!fmi->is_loaded()) {
+            fmi->destroy();
+            delete fmi;
+            fmi = NULL;
+        }
+    }
+
+    if (fmi == NULL) {
+        fmi = new BwaFMI(prefix);
+    }
+
+    if (!fmi->is_loaded()) {
+        fmi->destroy();
+        delete fmi;
+        return NULL;
+    }
+    return fmi;
+}
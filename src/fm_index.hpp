@@ -0,0 +1,124 @@
+/* MIT License
+ *
+ * Copyright (c) 2018 Sam Kovaka <skovaka@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef INCL_FM_INDEX
+#define INCL_FM_INDEX
+
+#include <string>
+#include <vector>
+#include <utility>
+#include "util.hpp"
+#include "range.hpp"
+#include "huge_pages.hpp"
+#include "sa_cache.hpp"
+#include "ref_names.hpp"
+
+//Operations mapping needs from an FM index, implemented by each index 
+//layout. Rows follow bwa: row 0 is the empty suffix, ranges are extended 
+//to the left, and a double stranded index holds the forward strand 
+//followed by its reverse complement. Like the rest of the mapper, copies 
+//are shallow and memory is freed by destroy()
+class FMIndex {
+    public:
+
+    virtual ~FMIndex() {}
+
+    virtual void destroy() = 0;
+    virtual bool is_loaded() const = 0;
+
+    //Range queries come in 64-bit and 32-bit versions, and 32-bit ranges
+    //can be used if size() fits in 32 bits
+    virtual Range get_neighbor(Range range, u8 base) const = 0;
+    virtual Range32 get_neighbor(Range32 range, u8 base) const = 0;
+
+    //Computes get_neighbor for all four bases in one pass
+    virtual void get_neighbors(Range range, Range out[ALPH_SIZE]) const = 0;
+    virtual void get_neighbors(Range32 range, Range32 out[ALPH_SIZE]) const = 0;
+
+    //Prefetches the data needed to extend the range
+    virtual void prefetch(Range range) const {}
+    virtual void prefetch(Range32 range) const {}
+
+    virtual Range get_full_range(u8 base) const = 0;
+
+    virtual u64 sa(u64 i) const = 0;
+
+    //Sets locs to the suffix array values of rows st to en
+    virtual void sa_range(u64 st, u64 en, u64 *locs) const;
+
+    virtual u64 size() const = 0;
+
+    //True if the index holds both strands, as bwa indexes do. Patterns
+    //are only extended to the left, so a forward strand index can only
+    //map reads from the reverse strand
+    virtual bool is_double_stranded() const = 0;
+
+    //Bytes used by the structures queried while mapping
+    virtual u64 byte_size() const = 0;
+
+    //Copies the query structures onto huge pages and/or a NUMA node, 
+    //replacing a file mapping. Returns the page size actually used
+    virtual HugePageMode move_to(HugePageMode mode, i32 node = NUMA_ANY) = 0;
+
+    //Returns a copy with its own query structures on the given page size 
+    //and NUMA node, or NULL if it couldn't be allocated. Everything else 
+    //is shared with this index, and destroying the copy only frees what 
+    //it owns
+    virtual FMIndex *replicate(HugePageMode mode, u32 node, 
+                               HugePageMode *used = NULL) const = 0;
+
+    //Layouts which sample the suffix array every sa_intv rows can change
+    //the interval and cache positions that need LF steps to locate. 
+    //get_sa_intv() is 0 for other layouts
+    virtual u64 get_sa_intv() const;
+    virtual bool set_sa_intv(u64 intv);
+    virtual bool init_sa_cache(u64 max_bytes);
+    virtual const SACache *get_sa_cache() const;
+
+    //Returns the id of the contig containing sa_loc and sets ref_loc to
+    //the offset within it, or returns -1 if sa_loc is out of range
+    inline i32 translate_loc(u64 sa_loc, u64 &ref_loc) const {
+        i32 rid = names_->get_id(sa_loc);
+        if (rid >= 0) ref_loc = sa_loc - names_->get_offset(rid);
+        return rid;
+    }
+
+    const RefNames::Ptr &get_names() const;
+
+    std::vector< std::pair<std::string, u64> > get_seqs() const;
+
+    protected:
+    RefNames::Ptr names_;
+};
+
+//Identifies the reference an index was built from by its length, contigs
+//and a sample of its content, which is cheap to compute at load time. 
+//Stored by the files computed from an index to check they still match it
+u64 index_checksum(const FMIndex &fmi);
+
+//Loads the index with the given prefix: the run-length index 
+//<prefix>.urlb if it exists and matches the reference, otherwise <prefix>.ufmi
+//or the bwa index. Returns NULL if it couldn't be loaded
+FMIndex *load_fm_index(const std::string &prefix);
+
+#endif
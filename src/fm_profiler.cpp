@@ -23,12 +23,12 @@
 
 #include <string>
 #include <iostream>
-#include "bwa_fmi.hpp"
+#include "fm_index.hpp"
 #include "params.hpp"
 #include "fm_profiler.hpp"
 
 FMProfiler::FMProfiler() {
-    range_counts_.resize(PARAMS.fmi.size());
+    range_counts_.resize(INDEX_REGISTRY.get()->fmi->size());
     kmer_counts_.resize(PARAMS.model.kmer_count());
 }
 
@@ -38,15 +38,16 @@ void FMProfiler::add_range(Range r) {
     }
 }
 
-void FMProfiler::add_kmer(u16 k) {
+void FMProfiler::add_kmer(u32 k) {
     kmer_counts_[k]++;
 }
 
 void FMProfiler::flush_kmers() {
+    IndexRegistry::Ptr index = INDEX_REGISTRY.get();
     for (u64 k = 0; k < kmer_counts_.size(); k++) {
         if (kmer_counts_[k] == 0) continue;
 
-        Range r = PARAMS.kmer_fmranges[k];
+        Range r = index->kmer_fmranges[k];
         for (u64 i = r.start_; i <= r.end_; i++) {
             range_counts_[i] += kmer_counts_[k];
         }
@@ -68,15 +69,16 @@ void FMProfiler::combine(const FMProfiler &p) {
 void FMProfiler::write(const std::string &fname) {
     flush_kmers();
     std::vector<u32> ref_counts(range_counts_.size());
+    IndexRegistry::Ptr index = INDEX_REGISTRY.get();
 
     for (u64 i = 0; i < ref_counts.size(); i++) {
-        ref_counts[PARAMS.fmi.sa(i)] = range_counts_[i];
+        ref_counts[index->fmi->sa(i)] = range_counts_[i];
     }
 
     std::ofstream out(fname);
 
     u64 i = 0;
-    for (auto seq : PARAMS.fmi.get_seqs()) {
+    for (auto seq : index->fmi->get_seqs()) {
         std::string name = seq.first;
         u64 len = seq.second;
         for (u64 j = 0; j < len; j++) {
@@ -36,7 +36,7 @@ class FMProfiler {
     FMProfiler();
 
     void add_range(Range r);
-    void add_kmer(u16 k);
+    void add_kmer(u32 k);
     void flush_kmers();
     void combine(const FMProfiler &p);
     void write(const std::string &fname);
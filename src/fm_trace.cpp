@@ -0,0 +1,174 @@
+/* MIT License
+ *
+ * Copyright (c) 2018 Sam Kovaka <skovaka@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include <iostream>
+#include "fm_trace.hpp"
+
+static const u64 WRITE_BLOCK = 1 << 16;
+
+FMTracer::FMTracer(FMIndex *fmi, const std::string &fname) 
+    : fmi_(fmi),
+      writer_(std::make_shared<Writer>()) {
+    names_ = fmi_->get_names();
+    writer_->out.open(fname, std::ios::binary);
+    if (!writer_->out.good()) {
+        std::cerr << "Error: failed to open trace file '" << fname << "'\n";
+    }
+}
+
+FMTracer::FMTracer(FMIndex *fmi, std::shared_ptr<Writer> writer) 
+    : fmi_(fmi),
+      writer_(writer) {
+    names_ = fmi_->get_names();
+}
+
+FMTracer::Writer::~Writer() {
+    out.write((const char *) buf.data(), buf.size() * sizeof(FMQuery));
+}
+
+void FMTracer::Writer::add(u64 start, u64 end, FMQuery::Type type, u32 base) {
+    FMQuery q;
+    q.start = start;
+    q.end = end;
+    q.type = type;
+    q.base = base;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    buf.push_back(q);
+    if (buf.size() >= WRITE_BLOCK) {
+        out.write((const char *) buf.data(), buf.size() * sizeof(FMQuery));
+        buf.clear();
+    }
+}
+
+void FMTracer::destroy() {
+    if (fmi_ != NULL) {
+        fmi_->destroy();
+        delete fmi_;
+        fmi_ = NULL;
+    }
+    names_.reset();
+    writer_.reset();
+}
+
+bool FMTracer::is_loaded() const {
+    return fmi_->is_loaded();
+}
+
+Range FMTracer::get_neighbor(Range r, u8 base) const {
+    writer_->add(r.start_, r.end_, FMQuery::NEIGHBOR, base);
+    return fmi_->get_neighbor(r, base);
+}
+
+Range32 FMTracer::get_neighbor(Range32 r, u8 base) const {
+    writer_->add(r.start_, r.end_, FMQuery::NEIGHBOR, base);
+    return fmi_->get_neighbor(r, base);
+}
+
+void FMTracer::get_neighbors(Range r, Range out[ALPH_SIZE]) const {
+    writer_->add(r.start_, r.end_, FMQuery::NEIGHBORS, 0);
+    fmi_->get_neighbors(r, out);
+}
+
+void FMTracer::get_neighbors(Range32 r, Range32 out[ALPH_SIZE]) const {
+    writer_->add(r.start_, r.end_, FMQuery::NEIGHBORS, 0);
+    fmi_->get_neighbors(r, out);
+}
+
+void FMTracer::prefetch(Range r) const {
+    fmi_->prefetch(r);
+}
+
+void FMTracer::prefetch(Range32 r) const {
+    fmi_->prefetch(r);
+}
+
+Range FMTracer::get_full_range(u8 base) const {
+    return fmi_->get_full_range(base);
+}
+
+u64 FMTracer::sa(u64 i) const {
+    writer_->add(i, i, FMQuery::SA, 0);
+    return fmi_->sa(i);
+}
+
+void FMTracer::sa_range(u64 st, u64 en, u64 *locs) const {
+    writer_->add(st, en, FMQuery::SA, 0);
+    fmi_->sa_range(st, en, locs);
+}
+
+u64 FMTracer::size() const {
+    return fmi_->size();
+}
+
+bool FMTracer::is_double_stranded() const {
+    return fmi_->is_double_stranded();
+}
+
+u64 FMTracer::byte_size() const {
+    return fmi_->byte_size();
+}
+
+HugePageMode FMTracer::move_to(HugePageMode mode, i32 node) {
+    return fmi_->move_to(mode, node);
+}
+
+FMIndex *FMTracer::replicate(HugePageMode mode, u32 node, 
+                             HugePageMode *used) const {
+    FMIndex *copy = fmi_->replicate(mode, node, used);
+    if (copy == NULL) return NULL;
+    return new FMTracer(copy, writer_);
+}
+
+u64 FMTracer::get_sa_intv() const {
+    return fmi_->get_sa_intv();
+}
+
+bool FMTracer::set_sa_intv(u64 intv) {
+    return fmi_->set_sa_intv(intv);
+}
+
+bool FMTracer::init_sa_cache(u64 max_bytes) {
+    return fmi_->init_sa_cache(max_bytes);
+}
+
+const SACache *FMTracer::get_sa_cache() const {
+    return fmi_->get_sa_cache();
+}
+
+bool read_fm_trace(const std::string &fname, std::vector<FMQuery> &queries) {
+    std::ifstream in(fname, std::ios::binary | std::ios::ate);
+    if (!in.good()) return false;
+
+    u64 bytes = in.tellg();
+    if (bytes % sizeof(FMQuery) != 0) {
+        std::cerr << "Error: '" << fname << "' is not a trace file\n";
+        return false;
+    }
+
+    queries.resize(bytes / sizeof(FMQuery));
+    in.seekg(0);
+    in.read((char *) queries.data(), bytes);
+    return in.good();
+}
@@ -0,0 +1,103 @@
+/* MIT License
+ *
+ * Copyright (c) 2018 Sam Kovaka <skovaka@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef INCL_FM_TRACE
+#define INCL_FM_TRACE
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <fstream>
+#include "util.hpp"
+#include "fm_index.hpp"
+
+#define TRACE_SUFF ".utrc"
+
+//One recorded query. NEIGHBOR extends start-end by base, NEIGHBORS 
+//extends it by all four, and SA locates rows start to end
+struct FMQuery {
+    enum Type : u32 {NEIGHBOR, NEIGHBORS, SA, TYPE_COUNT};
+
+    u64 start, end;
+    Type type;
+    u32 base;
+};
+
+//Passes queries through to another index and appends them to a trace
+//file, which fm_bench can replay against each index layout. Shared by 
+//all threads, including through replicas
+class FMTracer final : public FMIndex {
+    public:
+
+    //Takes ownership of fmi
+    FMTracer(FMIndex *fmi, const std::string &fname);
+
+    void destroy();
+    bool is_loaded() const;
+
+    Range get_neighbor(Range range, u8 base) const;
+    Range32 get_neighbor(Range32 range, u8 base) const;
+    void get_neighbors(Range range, Range out[ALPH_SIZE]) const;
+    void get_neighbors(Range32 range, Range32 out[ALPH_SIZE]) const;
+    void prefetch(Range range) const;
+    void prefetch(Range32 range) const;
+
+    Range get_full_range(u8 base) const;
+    u64 sa(u64 i) const;
+    void sa_range(u64 st, u64 en, u64 *locs) const;
+
+    u64 size() const;
+    bool is_double_stranded() const;
+    u64 byte_size() const;
+
+    HugePageMode move_to(HugePageMode mode, i32 node = NUMA_ANY);
+    FMIndex *replicate(HugePageMode mode, u32 node, 
+                       HugePageMode *used = NULL) const;
+
+    u64 get_sa_intv() const;
+    bool set_sa_intv(u64 intv);
+    bool init_sa_cache(u64 max_bytes);
+    const SACache *get_sa_cache() const;
+
+    private:
+    //Queries are buffered and written in blocks
+    struct Writer {
+        std::mutex mutex;
+        std::ofstream out;
+        std::vector<FMQuery> buf;
+
+        ~Writer();
+        void add(u64 start, u64 end, FMQuery::Type type, u32 base);
+    };
+
+    FMTracer(FMIndex *fmi, std::shared_ptr<Writer> writer);
+
+    FMIndex *fmi_;
+    std::shared_ptr<Writer> writer_;
+};
+
+//Reads every query in a trace file. Returns false if it can't be read
+bool read_fm_trace(const std::string &fname, std::vector<FMQuery> &queries);
+
+#endif
@@ -0,0 +1,165 @@
+/* MIT License
+ *
+ * Copyright (c) 2018 Sam Kovaka <skovaka@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <iostream>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <sys/mman.h>
+#include "huge_pages.hpp"
+
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT 26
+#endif
+
+static const u64 MB2 = 1ull << 21, 
+                 GB1 = 1ull << 30;
+
+//Stored before each allocation so huge_free knows what to unmap. len is
+//0 for heap allocations
+struct HugeHeader {
+    void *base;
+    u64 len;
+    char pad[48];
+};
+
+const char *huge_page_name(HugePageMode mode) {
+    switch (mode) {
+        case HUGE_THP: return "transparent huge";
+        case HUGE_2MB: return "2 MB huge";
+        case HUGE_1GB: return "1 GB huge";
+        default:       return "normal";
+    }
+}
+
+static u64 round_up(u64 bytes, u64 page) {
+    return (bytes + page - 1) / page * page;
+}
+
+//madvise is ignored if transparent huge pages are disabled
+static bool thp_enabled() {
+    std::ifstream in("/sys/kernel/mm/transparent_hugepage/enabled");
+    std::string policy;
+    std::getline(in, policy);
+    return !policy.empty() && policy.find("[never]") == std::string::npos;
+}
+
+static void *map_pages(u64 len, int flags) {
+    void *p = mmap(NULL, len, PROT_READ | PROT_WRITE, 
+                   MAP_PRIVATE | MAP_ANONYMOUS | flags, -1, 0);
+    return p == MAP_FAILED ? NULL : p;
+}
+
+void *huge_alloc(u64 bytes, HugePageMode mode, HugePageMode *used, i32 node) {
+    bytes += sizeof(HugeHeader);
+
+    //Memory policies need whole pages, otherwise the heap will do
+    if (mode == HUGE_NONE && node == NUMA_ANY) {
+        void *base;
+        if (posix_memalign(&base, 64, bytes) != 0) return NULL;
+        std::memset(base, 0, bytes);
+        if (used != NULL) *used = HUGE_NONE;
+
+        HugeHeader *h = (HugeHeader *) base;
+        h->base = base;
+        h->len = 0;
+        return h + 1;
+    }
+
+    void *base = NULL;
+    u64 len = 0;
+    HugePageMode got = HUGE_NONE;
+
+    #ifdef MAP_HUGETLB
+    if (mode == HUGE_1GB) {
+        len = round_up(bytes, GB1);
+        base = map_pages(len, MAP_HUGETLB | (30 << MAP_HUGE_SHIFT));
+        got = HUGE_1GB;
+    }
+    if (base == NULL && mode >= HUGE_2MB) {
+        len = round_up(bytes, MB2);
+        base = map_pages(len, MAP_HUGETLB | (21 << MAP_HUGE_SHIFT));
+        got = HUGE_2MB;
+    }
+    #endif
+
+    //THP only backs 2 MB aligned regions, so map extra and trim the ends
+    if (base == NULL && mode >= HUGE_THP) {
+        len = round_up(bytes, MB2);
+        u8 *p = (u8 *) map_pages(len + MB2, 0);
+        if (p != NULL) {
+            u8 *aligned = (u8 *) round_up((u64) p, MB2);
+            if (aligned > p) munmap(p, aligned - p);
+            munmap(aligned + len, (p + MB2) - aligned);
+            base = aligned;
+
+            #ifdef MADV_HUGEPAGE
+            got = madvise(base, len, MADV_HUGEPAGE) == 0 && thp_enabled() 
+                ? HUGE_THP : HUGE_NONE;
+            #else
+            got = HUGE_NONE;
+            #endif
+        }
+    }
+
+    if (base == NULL) {
+        len = bytes;
+        base = map_pages(len, 0);
+        got = HUGE_NONE;
+    }
+
+    if (base == NULL) return NULL;
+    if (used != NULL) *used = got;
+
+    if (!numa_bind(base, len, node)) {
+        std::cerr << "Warning: failed to set NUMA memory policy\n";
+    }
+
+    HugeHeader *h = (HugeHeader *) base;
+    h->base = base;
+    h->len = len;
+    return h + 1;
+}
+
+void *thp_alloc(u64 bytes, bool huge) {
+    u64 align = huge && bytes >= MB2 ? MB2 : 64;
+    void *p;
+    if (posix_memalign(&p, align, bytes) != 0) return NULL;
+
+    #ifdef MADV_HUGEPAGE
+    if (align == MB2) madvise(p, bytes / MB2 * MB2, MADV_HUGEPAGE);
+    #endif
+
+    return p;
+}
+
+void huge_free(void *ptr) {
+    if (ptr == NULL) return;
+    HugeHeader *h = ((HugeHeader *) ptr) - 1;
+    if (h->len == 0) {
+        free(h->base);
+    } else {
+        munmap(h->base, h->len);
+    }
+}
@@ -0,0 +1,93 @@
+/* MIT License
+ *
+ * Copyright (c) 2018 Sam Kovaka <skovaka@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef INCL_HUGE_PAGES
+#define INCL_HUGE_PAGES
+
+#include <cstdlib>
+#include <new>
+#include <type_traits>
+#include "util.hpp"
+#include "numa.hpp"
+
+//Page sizes to try for large arrays, from least to most restrictive. 
+//HUGE_THP uses normal pages with transparent huge pages requested, the 
+//others need pages reserved through hugetlbfs
+enum HugePageMode {HUGE_NONE, HUGE_THP, HUGE_2MB, HUGE_1GB};
+
+const char *huge_page_name(HugePageMode mode);
+
+//Allocates zeroed memory on the largest page size available up to mode. 
+//Falls back to smaller pages if they can't be reserved, and sets used 
+//to the mode actually used. Pages are placed on the given NUMA node, or
+//interleaved if NUMA_ALL. Returns 64-byte aligned memory or NULL. Meant
+//for the large index arrays, and uses the heap for HUGE_NONE with no node
+void *huge_alloc(u64 bytes, HugePageMode mode, HugePageMode *used = NULL,
+                 i32 node = NUMA_ANY);
+
+void huge_free(void *ptr);
+
+//Heap memory for per-thread buffers. If huge, allocations of at least 
+//2 MB are 2 MB aligned and the whole 2 MB regions they cover are marked 
+//for transparent huge pages, so nothing is rounded up. Free with free()
+void *thp_alloc(u64 bytes, bool huge);
+
+//Allocator for vectors using thp_alloc. All instances can free each 
+//other's memory, so containers can swap regardless of huge
+template <typename T>
+struct ThpAllocator {
+    typedef T value_type;
+    typedef std::true_type propagate_on_container_move_assignment;
+    typedef std::true_type propagate_on_container_swap;
+
+    bool huge;
+
+    ThpAllocator() : huge(false) {}
+
+    explicit ThpAllocator(bool huge_) : huge(huge_) {}
+
+    template <typename U>
+    ThpAllocator(const ThpAllocator<U> &a) : huge(a.huge) {}
+
+    T *allocate(size_t n) {
+        void *p = thp_alloc(n * sizeof(T), huge);
+        if (p == NULL) throw std::bad_alloc();
+        return (T *) p;
+    }
+
+    void deallocate(T *p, size_t) {
+        free(p);
+    }
+};
+
+template <typename T, typename U>
+bool operator==(const ThpAllocator<T> &, const ThpAllocator<U> &) {
+    return true;
+}
+
+template <typename T, typename U>
+bool operator!=(const ThpAllocator<T> &, const ThpAllocator<U> &) {
+    return false;
+}
+
+#endif
@@ -0,0 +1,573 @@
+/* MIT License
+ *
+ * Copyright (c) 2018 Sam Kovaka <skovaka@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+//Builds small references with "bwa index" and checks the index formats
+//UNCALLED derives from them. Run with a scratch directory for the files:
+//  ./index_test /tmp/index_test
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <random>
+#include <cstdio>
+#include <unistd.h>
+#include "bwa/bwa.h"
+#include "bwa_fmi.hpp"
+#include "jump_table.hpp"
+#include "rl_bwt.hpp"
+#include "ref_index.hpp"
+#include "repeat_mask.hpp"
+
+static int failures = 0;
+
+#define CHECK(cond) \
+    if (!(cond)) { \
+        std::cerr << __FILE__ << ":" << __LINE__ \
+                  << ": check failed: " #cond "\n"; \
+        failures++; \
+    }
+
+static std::string random_seq(std::mt19937 &rng, u64 len) {
+    std::string seq(len, 'A');
+    for (u64 i = 0; i < len; i++) seq[i] = "ACGT"[rng() & 3];
+    return seq;
+}
+
+//Two random contigs with an ambiguous base, and a repetitive one so 
+//suffixes share long prefixes
+static void write_fasta(const std::string &fname, u32 seed) {
+    std::mt19937 rng(seed);
+    std::string ctg1 = random_seq(rng, 3000), 
+                ctg2 = random_seq(rng, 1500),
+                unit = random_seq(rng, 37),
+                ctg3;
+    ctg1[100] = 'N';
+    while (ctg3.size() < 2000) ctg3 += unit;
+
+    std::ofstream out(fname);
+    out << ">ctg1\n" << ctg1 << "\n" 
+        << ">ctg2 desc\n" << ctg2 << "\n"
+        << ">ctg3\n" << ctg3 << "\n";
+}
+
+//Long runs and tandem repeats, so suffixes share prefixes much longer 
+//than the suffix sorter's sampling period
+static void write_repeat_fasta(const std::string &fname, u32 seed, u64 len) {
+    std::mt19937 rng(seed);
+    std::string seq;
+    while (seq.size() < len) {
+        switch (rng() % 4) {
+        case 0:
+            seq += std::string(rng() % 3000, "ACGT"[rng() & 3]);
+            break;
+        case 1: {
+            std::string unit = random_seq(rng, 1 + rng() % 50);
+            for (u32 n = rng() % 100; n > 0; n--) seq += unit;
+            break;
+        }
+        case 2: 
+            if (seq.size() > 2000) seq += seq.substr(seq.size() - 2000);
+            break;
+        default:
+            seq += random_seq(rng, rng() % 2000);
+        }
+    }
+    seq.resize(len);
+
+    std::ofstream out(fname);
+    out << ">rep1\n" << seq.substr(0, len / 3) << "\n"
+        << ">rep2\n" << seq.substr(len / 3) << "\n";
+}
+
+static bool bwa_index(const std::string &fasta, const std::string &prefix) {
+    return bwa_idx_build(fasta.c_str(), prefix.c_str(), 
+                         BWTALGO_IS, 10000000) == 0;
+}
+
+//Compares every query used by the mapper between two indexes
+static void check_same_index(const FMIndex &a, const FMIndex &b) {
+    CHECK(a.size() == b.size());
+    if (a.size() != b.size()) return;
+
+    for (u8 c = 0; c < ALPH_SIZE; c++) {
+        CHECK(a.get_full_range(c) == b.get_full_range(c));
+    }
+
+    Range out_a[ALPH_SIZE], out_b[ALPH_SIZE];
+    for (u64 i = 0; i <= a.size(); i++) {
+        //Row 0 is the empty suffix, which bwa locates at -1
+        CHECK(i == 0 || a.sa(i) == b.sa(i));
+
+        Range r(i / 2 + 1, i);
+        if (r.start_ > r.end_) continue;
+        a.get_neighbors(r, out_a);
+        b.get_neighbors(r, out_b);
+        for (u8 c = 0; c < ALPH_SIZE; c++) {
+            CHECK(out_a[c] == out_b[c]);
+        }
+    }
+}
+
+//Forward strand bases stored in <prefix>.pac
+static std::string read_pac(const std::string &prefix, u64 len) {
+    std::ifstream in(prefix + ".pac", std::ios::binary);
+    std::vector<u8> pac((len + 3) / 4);
+    in.read((char *) pac.data(), pac.size());
+
+    std::string seq(len, 'A');
+    for (u64 i = 0; i < len; i++) {
+        seq[i] = "ACGT"[(pac[i >> 2] >> ((~i & 3) << 1)) & 3];
+    }
+    return seq;
+}
+
+static u8 base_id(char c) {
+    switch (c) {
+        case 'A': return 0;
+        case 'C': return 1;
+        case 'G': return 2;
+        default:  return 3;
+    }
+}
+
+//Backward search, extending to the left from the last base
+static Range find(const FMIndex &fmi, const std::string &pattern) {
+    Range r = fmi.get_full_range(base_id(pattern.back()));
+    for (u64 i = pattern.size() - 1; i > 0 && r.is_valid(); i--) {
+        r = fmi.get_neighbor(r, base_id(pattern[i - 1]));
+    }
+    return r;
+}
+
+//Every occurrence of substrings of text is found and located
+static void check_locate(const FMIndex &fmi, const std::string &text) {
+    for (u64 pos = 0; pos + 12 <= text.size(); pos += 97) {
+        std::string pattern = text.substr(pos, 12);
+
+        u64 count = 0;
+        for (u64 i = text.find(pattern); i != std::string::npos; 
+             i = text.find(pattern, i + 1)) {
+            count++;
+        }
+
+        Range r = find(fmi, pattern);
+        CHECK(r.is_valid() && r.length() == count);
+        for (u64 row = r.start_; r.is_valid() && row <= r.end_; row++) {
+            CHECK(text.compare(fmi.sa(row), 12, pattern) == 0);
+        }
+    }
+}
+
+//Locating a whole range at once with phi and its inverse matches 
+//locating each row. Uses the full range of each base, ranges of sampled
+//substrings and every 8-row window, including those at row 0 and the 
+//last row where the cyclic phi samples meet
+static void check_sa_range(const FMIndex &a, const FMIndex &b, 
+                           const std::string &text) {
+    std::vector<Range> ranges;
+    for (u8 c = 0; c < ALPH_SIZE; c++) {
+        ranges.push_back(a.get_full_range(c));
+    }
+    for (u64 len = 4; len <= 12; len += 4) {
+        for (u64 pos = 0; pos + len <= text.size(); pos += 97) {
+            ranges.push_back(find(a, text.substr(pos, len)));
+        }
+    }
+    for (u64 i = 0; i + 7 <= a.size(); i++) {
+        ranges.push_back(Range(i, i + 7));
+    }
+
+    std::vector<u64> locs;
+    for (const Range &r : ranges) {
+        if (!r.is_valid()) continue;
+
+        locs.resize(r.length());
+        b.sa_range(r.start_, r.end_, locs.data());
+        for (u64 row = r.start_; row <= r.end_; row++) {
+            //Row 0 is the empty suffix, which bwa locates at -1
+            CHECK(row == 0 || locs[row - r.start_] == a.sa(row));
+        }
+    }
+}
+
+static u64 file_size(const std::string &fname) {
+    std::ifstream in(fname, std::ios::binary | std::ios::ate);
+    return in.good() ? (u64) in.tellg() : 0;
+}
+
+//.ufmi written from a bwa index matches it, and is rejected once the 
+//reference changes or the file is truncated
+static void test_fmi_file(const std::string &dir) {
+    std::string fasta = dir + "/ref.fa", prefix = dir + "/ref";
+    write_fasta(fasta, 1);
+    CHECK(bwa_index(fasta, prefix));
+    CHECK(write_fmi(prefix, 0));
+
+    BwaFMI bwa(prefix, false), mapped(prefix, true);
+    CHECK(bwa.is_loaded() && !bwa.is_mapped());
+    CHECK(mapped.is_loaded() && mapped.is_mapped());
+    CHECK(mapped.is_double_stranded());
+    check_same_index(bwa, mapped);
+    mapped.destroy();
+
+    //Resampled suffix array
+    CHECK(write_fmi(prefix, 4));
+    BwaFMI resampled(prefix, true);
+    CHECK(resampled.is_mapped() && resampled.get_sa_intv() == 4);
+    check_same_index(bwa, resampled);
+    resampled.destroy();
+    bwa.destroy();
+
+    //Stale .ufmi from another reference with the same prefix
+    std::string stale = dir + "/stale.ufmi";
+    CHECK(std::rename((prefix + FMI_SUFF).c_str(), stale.c_str()) == 0);
+    write_fasta(fasta, 2);
+    CHECK(bwa_index(fasta, prefix));
+    CHECK(std::rename(stale.c_str(), (prefix + FMI_SUFF).c_str()) == 0);
+
+    BwaFMI fallback(prefix, true);
+    CHECK(fallback.is_loaded() && !fallback.is_mapped());
+    fallback.destroy();
+
+    //Truncated file
+    CHECK(write_fmi(prefix, 0));
+    u64 size = file_size(prefix + FMI_SUFF);
+    CHECK(truncate((prefix + FMI_SUFF).c_str(), size - 64) == 0);
+    BwaFMI truncated(prefix, true);
+    CHECK(truncated.is_loaded() && !truncated.is_mapped());
+    truncated.destroy();
+}
+
+//The r-index answers queries like the bwa index it was built from, and a
+//stale one is rejected so the FM index is loaded instead
+static void test_rl_bwt(const std::string &dir) {
+    std::string fasta = dir + "/rl.fa", prefix = dir + "/rl";
+    write_fasta(fasta, 5);
+    CHECK(bwa_index(fasta, prefix));
+    CHECK(write_rlbwt(prefix));
+
+    BwaFMI bwa(prefix, false);
+    RunLengthBWT rl(prefix);
+    CHECK(bwa.is_loaded() && rl.is_loaded());
+    CHECK(rl.is_double_stranded());
+    CHECK(rl.run_count() > 0 && rl.run_count() <= rl.size() + 1);
+    check_same_index(bwa, rl);
+    check_sa_range(bwa, rl, read_pac(prefix, bwa.size() / 2));
+    rl.destroy();
+    bwa.destroy();
+
+    std::string stale = dir + "/stale.urlb";
+    CHECK(std::rename((prefix + RLBWT_SUFF).c_str(), stale.c_str()) == 0);
+    write_fasta(fasta, 6);
+    CHECK(bwa_index(fasta, prefix));
+    CHECK(std::rename(stale.c_str(), (prefix + RLBWT_SUFF).c_str()) == 0);
+
+    RunLengthBWT rejected(prefix);
+    CHECK(!rejected.is_loaded());
+    rejected.destroy();
+
+    FMIndex *fmi = load_fm_index(prefix);
+    CHECK(fmi != NULL && dynamic_cast<BwaFMI *>(fmi) != NULL);
+    if (fmi != NULL) {
+        fmi->destroy();
+        delete fmi;
+    }
+}
+
+//Same contig names, lengths and base counts with each sequence reversed
+static void write_reversed_fasta(const std::string &fname, 
+                                 const std::string &out_fname) {
+    std::ifstream in(fname);
+    std::ofstream out(out_fname);
+    std::string line;
+    while (std::getline(in, line)) {
+        if (line[0] != '>') line.assign(line.rbegin(), line.rend());
+        out << line << "\n";
+    }
+}
+
+//Thresholds and k-mer ranges written to .uncl are read back for the 
+//chosen preset, and rejected for a reference that only differs in content
+static void test_params(const std::string &dir) {
+    std::string fasta = dir + "/params.fa", prefix = dir + "/params",
+                reversed = dir + "/params_rev.fa";
+    write_fasta(fasta, 7);
+    CHECK(bwa_index(fasta, prefix));
+    CHECK(write_index_params(prefix, 5, {"fast", "default"}, 
+                             {{-10, -9}, {-8}}, {0.5, 0.6}, {1, 2}));
+
+    IndexOptions opts;
+    opts.kmer_len = 5;
+    opts.param_preset = "fast";
+
+    RefIndex index;
+    CHECK(index.load(prefix, opts));
+    CHECK(index.prob_threshes.size() == 64);
+    CHECK(index.get_prob_thresh(1) == -10 && index.get_prob_thresh(2) == -9);
+    CHECK(index.get_source_prob() == -9);
+    CHECK(index.kmer_fmranges.size() == 1024);
+    for (u64 k = 0; k < index.kmer_fmranges.size(); k++) {
+        //Ranges are extended to the left from the k-mer id's first base
+        std::string kmer(5, 'A');
+        for (u8 i = 0; i < 5; i++) {
+            kmer[4 - i] = "ACGT"[(k >> (2 * (4 - i))) & 3];
+        }
+        Range r = find(*index.fmi, kmer);
+        CHECK(r.is_valid() == index.kmer_fmranges[k].is_valid());
+        CHECK(!r.is_valid() || r == index.kmer_fmranges[k]);
+    }
+    index.destroy();
+
+    //Last preset by default, and a missing one isn't loaded
+    opts.param_preset = "";
+    RefIndex last;
+    CHECK(last.load(prefix, opts) && last.get_source_prob() == -8);
+    last.destroy();
+
+    opts.param_preset = "missing";
+    RefIndex missing;
+    CHECK(!missing.load(prefix, opts));
+    missing.destroy();
+
+    write_reversed_fasta(fasta, reversed);
+    CHECK(bwa_index(reversed, prefix));
+    opts.param_preset = "fast";
+    RefIndex stale;
+    CHECK(!stale.load(prefix, opts));
+    stale.destroy();
+}
+
+//Sequences added to an index use its thresholds until their own are 
+//written, along with their own jump table
+static void test_added(const std::string &dir) {
+    std::string fasta = dir + "/main.fa", prefix = dir + "/main",
+                added_fasta = dir + "/main.add.fa", 
+                added_prefix = prefix + ADDED_SUFF;
+    write_fasta(fasta, 9);
+    write_fasta(added_fasta, 10);
+    CHECK(bwa_index(fasta, prefix));
+    CHECK(write_index_params(prefix, 5, {"default"}, {{-10}}, {0.5}, {1}));
+    CHECK(build_fmi(added_fasta, added_prefix, 32, 1));
+
+    IndexOptions opts;
+    opts.kmer_len = 5;
+
+    RefIndex shared;
+    CHECK(shared.load(prefix, opts) && shared.added != NULL);
+    if (shared.added != NULL) {
+        CHECK(shared.added->prob_threshes == shared.prob_threshes);
+        CHECK(shared.added->kmer_fmranges.size() == 1024);
+        CHECK(shared.added->jump_table.max_len() == 0);
+    }
+    shared.destroy();
+
+    CHECK(write_index_params(added_prefix, 5, {"default"}, {{-3}}, 
+                             {0.5}, {1}));
+    CHECK(write_jump_table(added_prefix, 5, 6));
+
+    RefIndex own;
+    CHECK(own.load(prefix, opts) && own.added != NULL);
+    if (own.added != NULL) {
+        CHECK(own.get_prob_thresh(1) == -10);
+        CHECK(own.added->get_prob_thresh(1) == -3);
+        CHECK(own.added->jump_table.max_len() == 6);
+        CHECK(own.jump_table.max_len() == 0);
+    }
+    own.destroy();
+}
+
+//Jump table ranges match extending the FM index, and a table built for 
+//another reference of the same length isn't loaded
+static void test_jump_table(const std::string &dir) {
+    std::string fasta = dir + "/jump.fa", prefix = dir + "/jump",
+                other_fasta = dir + "/jump_other.fa", 
+                other_prefix = dir + "/jump_other";
+    write_fasta(fasta, 3);
+    write_fasta(other_fasta, 4);
+    CHECK(bwa_index(fasta, prefix));
+    CHECK(bwa_index(other_fasta, other_prefix));
+
+    BwaFMI fmi(prefix, false), other(other_prefix, false);
+    CHECK(other.size() == fmi.size());
+
+    JumpTable built;
+    CHECK(!built.build(fmi, 4, JumpTable::MAX_LEN + 1));
+    CHECK(built.build(fmi, 4, 6));
+    CHECK(built.save(prefix + JUMP_SUFF));
+    built.destroy();
+
+    JumpTable table;
+    CHECK(table.load(prefix + JUMP_SUFF, fmi, 4));
+    CHECK(table.max_len() == 6);
+    for (u8 len = 4; len <= 6; len++) {
+        for (u32 seq = 0; seq < (1u << (2 * len)); seq++) {
+            Range r = fmi.get_full_range((seq >> (2 * len - 2)) & 3);
+            for (u8 i = 1; i < len && r.is_valid(); i++) {
+                r = fmi.get_neighbor(r, (seq >> (2 * (len - i - 1))) & 3);
+            }
+            Range stored = table.get(len, seq);
+            CHECK(r.is_valid() == stored.is_valid());
+            if (r.is_valid()) CHECK(r == stored);
+        }
+    }
+    table.destroy();
+
+    JumpTable stale;
+    CHECK(!stale.load(prefix + JUMP_SUFF, fmi, 5));
+    CHECK(!stale.load(prefix + JUMP_SUFF, other, 4));
+    CHECK(stale.max_len() == 0);
+
+    fmi.destroy();
+    other.destroy();
+}
+
+static std::string reverse_complement(const std::string &seq) {
+    std::string rev(seq.rbegin(), seq.rend());
+    for (char &c : rev) c = "TGCA"[base_id(c)];
+    return rev;
+}
+
+//Every min_len-mer of the repeat reference is masked exactly when it 
+//occurs more than once in either strand, and a mask built for another 
+//reference with the same contigs and base counts isn't loaded
+static void test_repeat_mask(const std::string &dir) {
+    std::string fasta = dir + "/rep.fa", prefix = dir + "/rep",
+                reversed = dir + "/rep_rev.fa";
+    const u32 len = 20000, min_len = 20;
+    write_repeat_fasta(fasta, 11, len);
+    CHECK(bwa_index(fasta, prefix));
+    CHECK(write_repeat_mask(prefix, fasta, min_len, 2));
+
+    BwaFMI fmi(prefix, false);
+    RepeatMask mask;
+    CHECK(mask.load(prefix + REPEAT_SUFF, fmi));
+    CHECK(mask.min_len() == min_len && mask.interval_count() > 0);
+
+    //Occurrences in the indexed text, both strands of every contig
+    std::string fwd = read_pac(prefix, len), 
+                text = fwd + reverse_complement(fwd);
+    std::map<std::string, u32> counts;
+    for (u64 i = 0; i + min_len <= text.size(); i++) {
+        counts[text.substr(i, min_len)]++;
+    }
+
+    //Repeats are only searched for within contigs, on either strand
+    u64 contig_st[2] = {0, len / 3}, contig_en[2] = {len / 3, len};
+    u64 masked = 0, unique = 0;
+    for (u8 c = 0; c < 2; c++) {
+        std::string ctg = fwd.substr(contig_st[c], 
+                                     contig_en[c] - contig_st[c]);
+        for (const std::string &seq : {ctg, reverse_complement(ctg)}) {
+            for (u64 i = 0; i + min_len <= seq.size(); i++) {
+                std::string kmer = seq.substr(i, min_len);
+                Range r = find(fmi, kmer);
+                bool repeat = counts[kmer] > 1;
+                CHECK(r.is_valid() && r.length() == counts[kmer]);
+                CHECK(mask.contains(r.start_, r.end_) == repeat);
+                if (repeat) masked++;
+                else unique++;
+            }
+        }
+    }
+    CHECK(masked > 0 && unique > 0);
+    mask.destroy();
+    fmi.destroy();
+
+    std::string stale = dir + "/stale.urep";
+    CHECK(std::rename((prefix + REPEAT_SUFF).c_str(), stale.c_str()) == 0);
+    write_reversed_fasta(fasta, reversed);
+    CHECK(bwa_index(reversed, prefix));
+    CHECK(std::rename(stale.c_str(), (prefix + REPEAT_SUFF).c_str()) == 0);
+
+    BwaFMI other(prefix, false);
+    RepeatMask rejected;
+    CHECK(!rejected.load(prefix + REPEAT_SUFF, other));
+    rejected.destroy();
+    other.destroy();
+}
+
+//The native builder produces the same BWT and suffix array as bwa
+static void test_build(const std::string &dir) {
+    std::string fasta = dir + "/build.fa", 
+                bwa_prefix = dir + "/build_bwa",
+                prefix = dir + "/build";
+
+    const u64 lens[] = {5, 999, 30001};
+    for (u64 len : lens) {
+        for (u16 threads = 1; threads <= 4; threads += 3) {
+            write_repeat_fasta(fasta, len + threads, len);
+            CHECK(bwa_index(fasta, bwa_prefix));
+            CHECK(build_fmi(fasta, prefix, 4, threads));
+
+            BwaFMI bwa(bwa_prefix, false), built(prefix, true);
+            CHECK(built.is_loaded() && built.is_mapped());
+            check_same_index(bwa, built);
+            for (u64 k = 0; k <= bwa.size(); k++) {
+                CHECK(bwa.bwt_base(k) == built.bwt_base(k));
+            }
+            bwa.destroy();
+            built.destroy();
+        }
+    }
+}
+
+//A forward-only build indexes the forward strand alone
+static void test_forward_only(const std::string &dir) {
+    std::string fasta = dir + "/fwd.fa", prefix = dir + "/fwd",
+                both_prefix = dir + "/both";
+    write_fasta(fasta, 5);
+    CHECK(build_fmi(fasta, prefix, 8, 2, true));
+    CHECK(build_fmi(fasta, both_prefix, 8, 2, false));
+
+    BwaFMI fmi(prefix, true), both(both_prefix, true);
+    CHECK(fmi.is_loaded() && fmi.is_mapped());
+    CHECK(both.is_loaded() && both.is_mapped());
+    CHECK(!fmi.is_double_stranded() && both.is_double_stranded());
+    CHECK(2 * fmi.size() == both.size());
+
+    check_locate(fmi, read_pac(prefix, fmi.size()));
+    fmi.destroy();
+    both.destroy();
+}
+
+int main(int argc, char **argv) {
+    std::string dir = argc > 1 ? argv[1] : ".";
+
+    test_fmi_file(dir);
+    test_rl_bwt(dir);
+    test_params(dir);
+    test_added(dir);
+    test_jump_table(dir);
+    test_repeat_mask(dir);
+    test_build(dir);
+    test_forward_only(dir);
+
+    if (failures > 0) {
+        std::cerr << failures << " checks failed\n";
+        return 1;
+    }
+    std::cerr << "All index tests passed\n";
+    return 0;
+}
@@ -0,0 +1,271 @@
+/* MIT License
+ *
+ * Copyright (c) 2018 Sam Kovaka <skovaka@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <cstdlib>
+#include <cstring>
+#include <cstdio>
+#include <iostream>
+#include <fstream>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "jump_table.hpp"
+
+struct JumpHeader {
+    char magic[8];
+    u64 version,
+        seq_len,
+        L2[ALPH_SIZE+1],
+        min_len,
+        max_len,
+        reserved[6];
+};
+
+static_assert(sizeof(JumpHeader) % 64 == 0, "JumpHeader must keep ranges aligned");
+
+static const char JUMP_MAGIC[8] = {'U','N','C','L','J','M','P','\0'};
+static const u64 JUMP_VERSION = 2;
+
+//Number of longest sequences whose ranges are recomputed when loading
+static const u64 CHECK_SAMPLES = 64;
+
+JumpTable::JumpTable()
+    : buf_(NULL),
+      mmap_buf_(NULL),
+      mmap_len_(0),
+      seq_len_(0),
+      min_len_(0),
+      max_len_(0) {
+    std::memset(levels_, 0, sizeof(levels_));
+    std::memset(L2_, 0, sizeof(L2_));
+}
+
+u64 JumpTable::range_count(u8 min_len, u8 max_len) {
+    u64 n = 0;
+    for (u8 l = min_len; l <= max_len; l++) {
+        n += 1ull << (2 * l);
+    }
+    return n;
+}
+
+void JumpTable::set_levels(const Range *ranges) {
+    std::memset(levels_, 0, sizeof(levels_));
+    for (u8 l = min_len_; l <= max_len_; l++) {
+        levels_[l] = ranges;
+        ranges += 1ull << (2 * l);
+    }
+}
+
+bool JumpTable::build(const FMIndex &fmi, u8 min_len, u8 max_len) {
+    if (max_len > MAX_LEN || min_len == 0 || min_len > max_len) {
+        std::cerr << "Error: jump table length must be between k-mer length and " 
+                  << (int) MAX_LEN << "\n";
+        return false;
+    }
+
+    void *mem;
+    u64 n = range_count(min_len, max_len);
+    if (posix_memalign(&mem, 64, n * sizeof(Range)) != 0) {
+        std::cerr << "Error: failed to allocate jump table\n";
+        return false;
+    }
+
+    buf_ = (Range *) mem;
+    min_len_ = min_len;
+    max_len_ = max_len;
+    seq_len_ = fmi.size();
+    for (u8 c = 0; c < ALPH_SIZE; c++) {
+        L2_[c] = fmi.get_full_range(c).start_;
+    }
+    L2_[ALPH_SIZE] = fmi.get_full_range(ALPH_SIZE - 1).end_;
+    set_levels(buf_);
+
+    //Shortest sequences are extended base by base, same as kmer_fmranges
+    Range *level = buf_;
+    for (u64 seq = 0; seq < (1ull << (2 * min_len)); seq++) {
+        Range r = fmi.get_full_range((seq >> (2 * min_len - 2)) & 0x3);
+        for (u8 i = 1; i < min_len; i++) {
+            r = fmi.get_neighbor(r, (seq >> (2 * (min_len - i - 1))) & 0x3);
+        }
+        level[seq] = r;
+    }
+
+    //Longer sequences extend each shorter range by all four bases
+    for (u8 l = min_len; l < max_len; l++) {
+        const Range *prev = levels_[l];
+        Range *next = const_cast<Range *>(levels_[l+1]);
+
+        for (u64 seq = 0; seq < (1ull << (2 * l)); seq++) {
+            Range *children = &next[seq << 2];
+            if (prev[seq].is_valid()) {
+                fmi.get_neighbors(prev[seq], children);
+            } else {
+                for (u8 b = 0; b < ALPH_SIZE; b++) {
+                    children[b] = Range();
+                }
+            }
+        }
+    }
+
+    return true;
+}
+
+bool JumpTable::load(const std::string &fname, const FMIndex &fmi, u8 min_len) {
+    int fd = open(fname.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (u64) st.st_size < sizeof(JumpHeader)) {
+        close(fd);
+        return false;
+    }
+
+    void *buf = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (buf == MAP_FAILED) {
+        std::cerr << "Error: failed to mmap '" << fname << "'\n";
+        return false;
+    }
+
+    const JumpHeader *h = (const JumpHeader *) buf;
+    bool valid = 
+        std::memcmp(h->magic, JUMP_MAGIC, sizeof(JUMP_MAGIC)) == 0 &&
+        h->version == JUMP_VERSION && 
+        h->seq_len == fmi.size() && 
+        h->min_len == min_len && min_len > 0 &&
+        h->max_len <= MAX_LEN && h->max_len >= h->min_len &&
+        sizeof(JumpHeader) + range_count(h->min_len, h->max_len) * sizeof(Range) 
+            == (u64) st.st_size;
+
+    for (u8 c = 0; valid && c < ALPH_SIZE; c++) {
+        valid = h->L2[c] == fmi.get_full_range(c).start_;
+    }
+    valid = valid && 
+            h->L2[ALPH_SIZE] == fmi.get_full_range(ALPH_SIZE - 1).end_;
+
+    if (valid) {
+        mmap_buf_ = buf;
+        mmap_len_ = st.st_size;
+        seq_len_ = h->seq_len;
+        std::memcpy(L2_, h->L2, sizeof(L2_));
+        min_len_ = h->min_len;
+        max_len_ = h->max_len;
+        set_levels((const Range *) ((const u8 *) buf + sizeof(JumpHeader)));
+        valid = matches(fmi);
+    }
+
+    if (!valid) {
+        std::cerr << "Error: '" << fname << "' does not match index or model, "
+                  << "not using jump table\n";
+        if (mmap_buf_ != NULL) {
+            destroy();
+        } else {
+            munmap(buf, st.st_size);
+        }
+        return false;
+    }
+
+    madvise(buf, st.st_size, MADV_RANDOM);
+
+    return true;
+}
+
+//Recomputes ranges spread over the longest level, which depend on the 
+//whole occurrence table rather than just the base counts
+bool JumpTable::matches(const FMIndex &fmi) const {
+    u64 n = 1ull << (2 * max_len_), 
+        step = n / CHECK_SAMPLES > 0 ? n / CHECK_SAMPLES : 1;
+
+    for (u64 seq = step / 2; seq < n; seq += step) {
+        Range r = fmi.get_full_range((seq >> (2 * max_len_ - 2)) & 0x3);
+        for (u8 i = 1; i < max_len_ && r.is_valid(); i++) {
+            r = fmi.get_neighbor(r, (seq >> (2 * (max_len_ - i - 1))) & 0x3);
+        }
+        Range stored = levels_[max_len_][seq];
+        if (r.is_valid() != stored.is_valid() || 
+            (r.is_valid() && !(r == stored))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool JumpTable::save(const std::string &fname) const {
+    JumpHeader h;
+    std::memset(&h, 0, sizeof(h));
+    std::memcpy(h.magic, JUMP_MAGIC, sizeof(JUMP_MAGIC));
+    h.version = JUMP_VERSION;
+    h.seq_len = seq_len_;
+    std::memcpy(h.L2, L2_, sizeof(L2_));
+    h.min_len = min_len_;
+    h.max_len = max_len_;
+
+    std::string tmp_fname = fname + ".tmp";
+    std::ofstream out(tmp_fname, std::ios::binary);
+    out.write((const char *) &h, sizeof(h));
+    out.write((const char *) levels_[min_len_], 
+              range_count(min_len_, max_len_) * sizeof(Range));
+    out.close();
+
+    if (!out.good() || rename(tmp_fname.c_str(), fname.c_str()) != 0) {
+        std::cerr << "Error: failed to write '" << fname << "'\n";
+        return false;
+    }
+
+    return true;
+}
+
+void JumpTable::destroy() {
+    if (buf_ != NULL) {
+        free(buf_);
+        buf_ = NULL;
+    }
+    if (mmap_buf_ != NULL) {
+        munmap(mmap_buf_, mmap_len_);
+        mmap_buf_ = NULL;
+    }
+    std::memset(levels_, 0, sizeof(levels_));
+    max_len_ = 0;
+}
+
+u8 JumpTable::max_len() const {
+    return max_len_;
+}
+
+bool write_jump_table(const std::string &bwa_prefix, u8 kmer_len, u8 max_len) {
+    FMIndex *fmi = load_fm_index(bwa_prefix);
+    if (fmi == NULL) {
+        std::cerr << "Error: failed to load index '" << bwa_prefix << "'\n";
+        return false;
+    }
+    JumpTable table;
+
+    bool ret = table.build(*fmi, kmer_len, max_len) && 
+               table.save(bwa_prefix + JUMP_SUFF);
+
+    table.destroy();
+    fmi->destroy();
+    delete fmi;
+    return ret;
+}
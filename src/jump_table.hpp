@@ -0,0 +1,87 @@
+/* MIT License
+ *
+ * Copyright (c) 2018 Sam Kovaka <skovaka@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef INCL_JUMP_TABLE
+#define INCL_JUMP_TABLE
+
+#include <string>
+#include "util.hpp"
+#include "range.hpp"
+#include "fm_index.hpp"
+
+#define JUMP_SUFF ".ujmp"
+
+//FM ranges of every sequence with length between the model's k and 
+//max_len, so paths near the root can look up their next range instead
+//of extending huge ranges through the occurrence table. Sequences are 
+//encoded like k-mer ids, with each extension shifted in as the lowest 
+//two bits
+class JumpTable {
+    public:
+
+    //4^12 ranges take 256MB, and longer sequences rarely have huge ranges
+    static const u8 MAX_LEN = 12;
+
+    JumpTable();
+
+    bool build(const FMIndex &fmi, u8 min_len, u8 max_len);
+
+    //Memory-maps a table written by save(). Fails if it was built for a 
+    //different index or k-mer length, checked with the index's base counts
+    //and a sample of the stored ranges
+    bool load(const std::string &fname, const FMIndex &fmi, u8 min_len);
+
+    bool save(const std::string &fname) const;
+
+    void destroy();
+
+    inline Range get(u8 len, u32 seq) const {
+        return levels_[len][seq];
+    }
+
+    //Prefetches the ranges of all four extensions of seq
+    inline void prefetch(u8 len, u32 seq) const {
+        __builtin_prefetch(&levels_[len + 1][seq << 2]);
+    }
+
+    //Length of the longest sequences stored, or 0 if not loaded
+    u8 max_len() const;
+
+    private:
+    void set_levels(const Range *ranges);
+
+    static u64 range_count(u8 min_len, u8 max_len);
+
+    bool matches(const FMIndex &fmi) const;
+
+    const Range *levels_[MAX_LEN + 1];
+    Range *buf_;
+    void *mmap_buf_;
+    u64 mmap_len_, seq_len_, L2_[ALPH_SIZE+1];
+    u8 min_len_, max_len_;
+};
+
+//Writes <prefix>.ujmp for sequences of length kmer_len to max_len
+bool write_jump_table(const std::string &bwa_prefix, u8 kmer_len, u8 max_len);
+
+#endif
@@ -28,9 +28,13 @@
 #include <string>
 #include <cmath>
 #include <stddef.h>
+#include <cstdlib>
+#include <algorithm>
+#include <iostream>
 #include "kmer_model.hpp"
 
 #define PI 3.1415926535897
+#define PROB_TABLE_STDVS 4
 
 
 std::string get_reverse_complement(const std::string &seq) {
@@ -50,10 +54,22 @@ std::string get_complement(const std::string &seq) {
 }
 
 KmerModel::KmerModel() 
-    : k_(0) {}
-
-KmerModel::KmerModel(std::string model_fname, bool complement) {
+    : k_(0),
+      prob_stride_(0),
+      prob_fn_(NULL),
+      prob_table_rows_(0) {}
+
+KmerModel::KmerModel(std::string model_fname, bool complement) 
+    : k_(0),
+      kmer_count_(0),
+      prob_stride_(0),
+      prob_fn_(NULL),
+      prob_table_rows_(0) {
     std::ifstream model_in(model_fname);
+    if (!model_in.good()) {
+        std::cerr << "Error: failed to open model '" << model_fname << "'\n";
+        return;
+    }
 
     //Read header and count number of columns
     std::string header;
@@ -72,7 +88,7 @@ KmerModel::KmerModel(std::string model_fname, bool complement) {
 
     //Variables for reading model
     std::string kmer, neighbor_kmer;
-    u16 k_id;
+    u32 k_id;
     float lv_mean, lv_stdv, sd_mean, sd_stdv, lambda, weight;
 
     //Check if table includes "ig_lambda" column
@@ -95,6 +111,15 @@ KmerModel::KmerModel(std::string model_fname, bool complement) {
         lambda_ = -1;
     }
 
+    //Mappers are only compiled for these lengths, and the tables indexed
+    //by k-mer grow by 4x per base
+    if (kmer.size() < MIN_KMER_LEN || kmer.size() > MAX_KMER_LEN) {
+        std::cerr << "Error: " << kmer.size() << "-mer models are not "
+                  << "supported, k-mers must be " << (int) MIN_KMER_LEN 
+                  << " to " << (int) MAX_KMER_LEN << " bases long\n";
+        return;
+    }
+
     //Compute number of kmers (4^k) and reserve space for model
     k_ = kmer.size();
     K_MASK_ =  ((1 << (2*k_)) - 1);
@@ -164,45 +189,201 @@ KmerModel::KmerModel(std::string model_fname, bool complement) {
     //Compute model level mean and stdv
     model_mean_ /= kmer_count_;
     model_stdv_ = 0;
-    for (u16 k_id = 0; k_id < kmer_count_; k_id++)
+    for (u32 k_id = 0; k_id < kmer_count_; k_id++)
         model_stdv_ += pow(lv_means_[k_id] - model_mean_, 2);
     model_stdv_ = sqrt(model_stdv_ / kmer_count_);
 
+    init_prob_block();
+}
+
+void KmerModel::init_prob_block() {
+    prob_stride_ = (kmer_count_ + 15) & ~15;
+
+    //Without the aligned block, probabilities are computed by the scalar
+    //code from the model's own arrays
+    void *mem;
+    if (posix_memalign(&mem, 64, 3 * prob_stride_ * sizeof(float)) != 0) {
+        std::cerr << "Warning: failed to allocate aligned k-mer model, "
+                  << "not using SIMD\n";
+        prob_block_.reset();
+        prob_fn_ = NULL;
+    } else {
+        float *means = (float *) mem;
+        std::fill(means, means + 3 * prob_stride_, 0);
+        std::copy(lv_means_.begin(), lv_means_.begin() + kmer_count_, means);
+        std::copy(lv_vars_x2_.begin(), lv_vars_x2_.begin() + kmer_count_, 
+                  means + prob_stride_);
+        std::copy(lognorm_denoms_.begin(), 
+                  lognorm_denoms_.begin() + kmer_count_, 
+                  means + 2 * prob_stride_);
+
+        prob_block_ = std::shared_ptr<const float>(means, free);
+        prob_fn_ = get_kmer_prob_fn();
+    }
+
+    level_order_.resize(kmer_count_);
+    for (u32 k = 0; k < kmer_count_; k++) level_order_[k] = k;
+    std::sort(level_order_.begin(), level_order_.end(), [&](u32 a, u32 b) {
+        return lv_means_[a] < lv_means_[b];
+    });
+
+    level_sorted_.resize(kmer_count_);
+    for (u32 i = 0; i < kmer_count_; i++) {
+        level_sorted_[i] = lv_means_[level_order_[i]];
+    }
 }
 
 bool KmerModel::event_valid(const Event &e) const {
     return e.mean > 0 && e.stdv >= 0 && e.length > 0;
 }
 
-float KmerModel::event_match_prob(float e, u16 k_id) const {
+float KmerModel::event_match_prob(float e, u32 k_id) const {
     return (-pow(e - lv_means_[k_id], 2) / lv_vars_x2_[k_id]) - lognorm_denoms_[k_id];
 }
 
-float KmerModel::event_match_prob(const Event &e, u16 k_id) const {
+const float *KmerModel::prob_table_row(float evt) const {
+    if (prob_table_rows_ > 0) {
+        float row = (evt - prob_table_min_) * prob_table_scale_ + 0.5;
+        if (row >= 0 && row < prob_table_rows_) {
+            return prob_table_.get() + u64(row) * prob_stride_;
+        }
+    }
+    return NULL;
+}
+
+const float *KmerModel::event_match_probs(float evt, float *probs) const {
+    const float *row = prob_table_row(evt);
+    if (row != NULL) return row;
+
+    compute_probs(evt, probs);
+    return probs;
+}
+
+void KmerModel::compute_probs(float evt, float *probs) const {
+    if (prob_fn_ == NULL) {
+        kmer_probs_scalar(evt, lv_means_.data(), lv_vars_x2_.data(), 
+                          lognorm_denoms_.data(), kmer_count_, probs);
+        return;
+    }
+    const float *means = prob_block_.get();
+    prob_fn_(evt, means, means + prob_stride_, means + 2 * prob_stride_, 
+             kmer_count_, probs);
+}
+
+float KmerModel::prob_window(float min_prob) const {
+    double window = 0;
+    for (u32 k = 0; k < kmer_count_; k++) {
+        double d2 = lv_vars_x2_[k] * (-lognorm_denoms_[k] - min_prob);
+        if (d2 > 0) window = std::max(window, sqrt(d2));
+    }
+
+    //Table rows are up to half a step from the event
+    if (prob_table_rows_ > 0) {
+        window += 0.5 / prob_table_scale_;
+    }
+
+    //Leeway for rounding in the probability kernels
+    return window * 1.001 + 0.001;
+}
+
+std::pair<KmerModel::level_itr, KmerModel::level_itr> 
+KmerModel::kmers_near(float evt, float window) const {
+    auto st = std::lower_bound(level_sorted_.begin(), level_sorted_.end(), evt - window),
+         en = std::upper_bound(st, level_sorted_.end(), evt + window);
+    return {level_order_.begin() + (st - level_sorted_.begin()),
+            level_order_.begin() + (en - level_sorted_.begin())};
+}
+
+bool KmerModel::init_prob_table(float res) {
+    prob_table_rows_ = 0;
+    prob_table_.reset();
+
+    if (res <= 0 || prob_stride_ == 0) return false;
+
+    float min_mean = lv_means_[0], max_mean = lv_means_[0], max_var_x2 = 0;
+    for (u32 k = 0; k < kmer_count_; k++) {
+        min_mean = std::min(min_mean, lv_means_[k]);
+        max_mean = std::max(max_mean, lv_means_[k]);
+        max_var_x2 = std::max(max_var_x2, lv_vars_x2_[k]);
+    }
+
+    //Events further out than this from every k-mer are computed exactly
+    float margin = PROB_TABLE_STDVS * sqrt(max_var_x2 / 2);
+    float min_evt = min_mean - margin;
+    u32 rows = u32((max_mean + margin - min_evt) / res) + 1;
+
+    void *mem;
+    if (posix_memalign(&mem, 64, u64(rows) * prob_stride_ * sizeof(float)) != 0) {
+        std::cerr << "Warning: failed to allocate k-mer probability table\n";
+        return false;
+    }
+
+    float *table = (float *) mem;
+    for (u32 r = 0; r < rows; r++) {
+        float *row = table + u64(r) * prob_stride_;
+        compute_probs(min_evt + r * res, row);
+        std::fill(row + kmer_count_, row + prob_stride_, 0);
+    }
+
+    prob_table_ = std::shared_ptr<const float>(table, free);
+    prob_table_rows_ = rows;
+    prob_table_min_ = min_evt;
+    prob_table_scale_ = 1 / res;
+
+    return true;
+}
+
+float KmerModel::prob_table_error() const {
+    if (prob_table_rows_ == 0) return 0;
+
+    std::vector<float> exact(kmer_count_), buf(kmer_count_);
+    float max_err = 0, max_dist = PROB_TABLE_STDVS * PROB_TABLE_STDVS / 2.0;
+
+    for (u32 r = 0; r + 1 < prob_table_rows_; r++) {
+        float evt = prob_table_min_ + (r + 0.49) / prob_table_scale_;
+        const float *probs = event_match_probs(evt, buf.data());
+        compute_probs(evt, exact.data());
+
+        for (u32 k = 0; k < kmer_count_; k++) {
+            float d = evt - lv_means_[k];
+            if (d * d <= max_dist * lv_vars_x2_[k]) {
+                max_err = std::max(max_err, std::abs(probs[k] - exact[k]));
+            }
+        }
+    }
+
+    return max_err;
+}
+
+u64 KmerModel::prob_table_bytes() const {
+    return u64(prob_table_rows_) * prob_stride_ * sizeof(float);
+}
+
+float KmerModel::event_match_prob(const Event &e, u32 k_id) const {
     return event_match_prob(e.mean, k_id);
 }
 
-u16 KmerModel::kmer_to_id(std::string kmer, u64 offset) const {
-    u16 id = BASE_BYTES[(u8) kmer[offset]];
+u32 KmerModel::kmer_to_id(std::string kmer, u64 offset) const {
+    u32 id = BASE_BYTES[(u8) kmer[offset]];
     for (u8 j = 1; j < k_; j++) {
         id = (id << 2) | BASE_BYTES[(u8) kmer[offset+j]];
     }
     return id;
 }
 
-u16 KmerModel::kmer_comp(u16 kmer) {
+u32 KmerModel::kmer_comp(u32 kmer) {
     return kmer ^ K_MASK_;
 }
 
-u8 KmerModel::get_base(u16 kmer, u8 i) const {
+u8 KmerModel::get_base(u32 kmer, u8 i) const {
     return (u8) ((kmer >> (2 * (k_-i-1))) & 0x3);
 }
 
-u8 KmerModel::get_first_base(u16 kmer) const {
+u8 KmerModel::get_first_base(u32 kmer) const {
     return (u8) ((kmer >> (2*k_ - 2)) & 0x3);
 }
 
-u8 KmerModel::get_last_base(u16 kmer) const {
+u8 KmerModel::get_last_base(u32 kmer) const {
     return (u8) (kmer & 0x3);
 }
 
@@ -266,15 +447,15 @@ void KmerModel::normalize(std::vector<float> &events, NormParams norm) const {
     }
 }
 
-u16 KmerModel::get_neighbor(u16 k, u8 i) const {
+u32 KmerModel::get_neighbor(u32 k, u8 i) const {
     return ((k << 2) & K_MASK_) | i; 
 }
 
 //Reads the given fasta file and stores forward and reverse k-mers
 void KmerModel::parse_fasta(
                  std::ifstream &fasta_in, 
-                 std::vector<u16> &fwd_ids, 
-                 std::vector<u16> &rev_ids) const {
+                 std::vector<u32> &fwd_ids, 
+                 std::vector<u32> &rev_ids) const {
 
     //For parsing the file
     std::string cur_line, prev_line, fwd_seq;
@@ -296,7 +477,7 @@ void KmerModel::parse_fasta(
         prev_line = cur_line;
     }
 
-    rev_ids = std::vector<u16>(fwd_ids.size());
+    rev_ids = std::vector<u32>(fwd_ids.size());
     for (u64 i = 0; i < fwd_ids.size(); i++)
         rev_ids[rev_ids.size()-i-1] = rev_comp_ids_[fwd_ids[i]];
 }
@@ -25,18 +25,52 @@
 #define _INCL_KMER_MODEL
 
 #include <array>
+#include <memory>
+#include <type_traits>
 #include <utility>
 #include "util.hpp"
 #include "event_detector.hpp"
+#include "kmer_probs.hpp"
 
 //TODO: move to normalizer
 typedef struct NormParams {
     float shift, scale;
 } NormParams;
 
+//Models with k-mers from MIN_KMER_LEN to MAX_KMER_LEN can be mapped with
+const u8 MIN_KMER_LEN = 4, MAX_KMER_LEN = 10;
+
+//Largest log probability error of a k-mer probability table that is used
+//for mapping, about that of a 0.03 pA resolution
+const float PROB_TABLE_MAX_ERROR = 0.05;
+
+//K-mer operations with compile-time masks, for code specialized on the
+//model's k-mer length. Ids are 16-bit up to 8-mers, 32-bit above
+template <u8 K>
+struct KmerLen {
+    typedef typename std::conditional<(K <= 8), u16, u32>::type Id;
+
+    static const u8 LEN = K;
+    static const u32 COUNT = u32(1) << (2 * K);
+    static const Id MASK = COUNT - 1;
+
+    static inline Id get_neighbor(Id k, u8 i) {
+        return ((k << 2) & MASK) | i;
+    }
+
+    static inline u8 get_base(Id k, u8 i) {
+        return (k >> (2 * (K - i - 1))) & 0x3;
+    }
+
+    static inline u8 get_last_base(Id k) {
+        return k & 0x3;
+    }
+};
+
 class KmerModel {
     public:
-    typedef std::vector<u16>::const_iterator neighbor_itr;
+    typedef std::vector<u32>::const_iterator neighbor_itr;
+    typedef std::vector<u32>::const_iterator level_itr;
 
     KmerModel();
     KmerModel(std::string model_fname, bool complement);
@@ -47,28 +81,57 @@ class KmerModel {
     NormParams get_norm_params(const std::vector<float> &events) const;
     void normalize(std::vector<float> &raw, NormParams norm={0, 0}) const;
 
-    u16 get_neighbor(u16 k, u8 i) const;
+    u32 get_neighbor(u32 k, u8 i) const;
 
     bool event_valid(const Event &e) const;
 
-    float event_match_prob(const Event &evt, u16 k_id) const;
-    float event_match_prob(float evt, u16 k_id) const;
+    float event_match_prob(const Event &evt, u32 k_id) const;
+    float event_match_prob(float evt, u32 k_id) const;
+
+    //Match probability of evt for every k-mer. Returns a row of the 
+    //probability table if evt falls within it, otherwise writes to probs
+    const float *event_match_probs(float evt, float *probs) const;
+
+    //Probability table row for evt, or NULL if it isn't in the table
+    const float *prob_table_row(float evt) const;
+
+    //Largest distance between an event and a k-mer's level mean where
+    //their match probability can be at least min_prob
+    float prob_window(float min_prob) const;
+
+    //K-mers with level means within window of evt, in level order
+    std::pair<level_itr, level_itr> kmers_near(float evt, float window) const;
+
+    //Precomputes event_match_probs for events every res pA across the 
+    //model's level range, with events rounded to the nearest row. A 
+    //resolution of 0 removes the table
+    bool init_prob_table(float res);
+
+    //Largest difference between table and exact probabilities of k-mers
+    //within four standard deviations of the event, checked halfway 
+    //between rows where rounding error is greatest
+    float prob_table_error() const;
+
+    u64 prob_table_bytes() const;
 
     float get_stay_prob(Event e1, Event e2) const; 
 
+    //False if the file couldn't be read or its k-mer length is unsupported
+    inline bool is_loaded() const {return k_ > 0;}
+
     inline u8 kmer_len() const {return k_;}
-    inline u16 kmer_count() const {return kmer_count_;}
+    inline u32 kmer_count() const {return kmer_count_;}
 
-    u16 kmer_to_id(std::string kmer, u64 offset = 0) const;
-    u16 kmer_comp(u16 kmer);
+    u32 kmer_to_id(std::string kmer, u64 offset = 0) const;
+    u32 kmer_comp(u32 kmer);
 
-    u8 get_first_base(u16 k) const;
-    u8 get_last_base(u16 k) const;
-    u8 get_base(u16 kmer, u8 i) const;
+    u8 get_first_base(u32 k) const;
+    u8 get_last_base(u32 k) const;
+    u8 get_base(u32 kmer, u8 i) const;
 
     void parse_fasta (std::ifstream &fasta_in, 
-                 std::vector<u16> &fwd_ids, 
-                 std::vector<u16> &rev_ids) const;
+                 std::vector<u32> &fwd_ids, 
+                 std::vector<u32> &rev_ids) const;
 
     std::vector<float> lv_means_, lv_vars_x2_, lognorm_denoms_, sd_means_, sd_stdvs_;
     //TODO: try floats
@@ -76,10 +139,31 @@ class KmerModel {
     float lambda_, model_mean_, model_stdv_;
     private:
     u8 k_;
-    u16 kmer_count_, K_MASK_;
+    u32 kmer_count_, K_MASK_;
     bool complement_;
 
-    std::vector<u16> rev_comp_ids_;
+    //lv_means_, lv_vars_x2_ and lognorm_denoms_ in one block, each 
+    //starting prob_stride_ floats after the last on a cache line. 
+    //Shared by copies of the model. NULL if it couldn't be allocated
+    std::shared_ptr<const float> prob_block_;
+    u32 prob_stride_;
+    KmerProbFn prob_fn_;
+
+    void init_prob_block();
+
+    //Exact probabilities of every k-mer, using prob_fn_ on prob_block_ 
+    //if it was allocated
+    void compute_probs(float evt, float *probs) const;
+
+    //K-mer ids sorted by level mean, and their means in that order
+    std::vector<u32> level_order_;
+    std::vector<float> level_sorted_;
+
+    std::shared_ptr<const float> prob_table_;
+    u32 prob_table_rows_;
+    float prob_table_min_, prob_table_scale_;
+
+    std::vector<u32> rev_comp_ids_;
 };
 
 #endif
@@ -0,0 +1,212 @@
+/* MIT License
+ *
+ * Copyright (c) 2018 Sam Kovaka <skovaka@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+//Checks k-mer match probabilities against the scalar computation, and 
+//that the mapper's sparse evaluation finds the same k-mers. Run 
+//with a model file, by default the r9.4 5-mer model:
+//  ./kmer_model_test uncalled/models/r94_5mers.txt
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <cstdio>
+#include <vector>
+#include <random>
+#include <cmath>
+#include <algorithm>
+#include "kmer_model.hpp"
+
+static int failures = 0;
+
+#define CHECK(cond) \
+    if (!(cond)) { \
+        std::cerr << __FILE__ << ":" << __LINE__ \
+                  << ": check failed: " #cond "\n"; \
+        failures++; \
+    }
+
+//Probabilities computed exactly from the model's arrays
+static void exact_probs(const KmerModel &model, float evt, float *probs) {
+    kmer_probs_scalar(evt, model.lv_means_.data(), model.lv_vars_x2_.data(),
+                      model.lognorm_denoms_.data(), model.kmer_count(), probs);
+}
+
+//Largest table error over k-mers within four standard deviations of 
+//random events, which is what prob_table_error measures
+static float measure_table_error(const KmerModel &model, u32 count) {
+    auto means = model.lv_means_.begin();
+    float lo = *std::min_element(means, means + model.kmer_count()),
+          hi = *std::max_element(means, means + model.kmer_count());
+
+    std::mt19937 rng(1);
+    std::uniform_real_distribution<float> evts(lo - 10, hi + 10);
+    std::vector<float> exact(model.kmer_count()), buf(model.kmer_count());
+    float max_err = 0;
+
+    for (u32 i = 0; i < count; i++) {
+        float evt = evts(rng);
+        const float *probs = model.event_match_probs(evt, buf.data());
+        exact_probs(model, evt, exact.data());
+
+        for (u32 k = 0; k < model.kmer_count(); k++) {
+            float d = evt - model.lv_means_[k];
+            if (d * d <= 8 * model.lv_vars_x2_[k]) {
+                max_err = std::max(max_err, std::abs(probs[k] - exact[k]));
+            }
+        }
+    }
+    return max_err;
+}
+
+//Without a table every event is computed exactly, by SIMD code if the 
+//CPU supports it
+static void test_exact(const KmerModel &model) {
+    std::vector<float> exact(model.kmer_count()), buf(model.kmer_count());
+    for (float evt = 40; evt < 160; evt += 0.37) {
+        const float *probs = model.event_match_probs(evt, buf.data());
+        exact_probs(model, evt, exact.data());
+        bool same = true;
+        for (u32 k = 0; k < model.kmer_count(); k++) {
+            same = same && probs[k] == exact[k];
+        }
+        CHECK(same);
+    }
+}
+
+//A fine table stays within the error bound used for mapping, while a 
+//coarse one exceeds it and would be dropped
+static void test_prob_table(KmerModel model) {
+    CHECK(model.init_prob_table(0.01));
+    CHECK(model.prob_table_bytes() > 0);
+
+    float err = model.prob_table_error(), 
+          measured = measure_table_error(model, 20000);
+    CHECK(err > 0 && err <= PROB_TABLE_MAX_ERROR);
+    CHECK(measured <= PROB_TABLE_MAX_ERROR);
+
+    //Events round to rows up to half a row away, slightly further than
+    //the points prob_table_error checks
+    CHECK(measured <= err * 1.05);
+
+    //Events beyond the table are computed exactly
+    std::vector<float> exact(model.kmer_count()), buf(model.kmer_count());
+    CHECK(model.prob_table_row(-1000) == NULL);
+    const float *probs = model.event_match_probs(-1000, buf.data());
+    exact_probs(model, -1000, exact.data());
+    CHECK(probs == buf.data() && probs[0] == exact[0]);
+
+    CHECK(model.init_prob_table(0.5));
+    CHECK(model.prob_table_error() > PROB_TABLE_MAX_ERROR);
+
+    CHECK(!model.init_prob_table(0));
+    CHECK(model.prob_table_bytes() == 0);
+    test_exact(model);
+}
+
+//The mapper's sparse mode scores single k-mers with event_match_prob 
+//and only looks for sources among kmers_near the event, so it matches 
+//the dense scan if those give the same probabilities and include every
+//k-mer at or above the source threshold
+static void test_sparse_probs(KmerModel model, float table_res) {
+    if (table_res > 0) CHECK(model.init_prob_table(table_res));
+
+    auto means = model.lv_means_.begin();
+    float lo = *std::min_element(means, means + model.kmer_count()),
+          hi = *std::max_element(means, means + model.kmer_count());
+
+    std::mt19937 rng(2);
+    std::uniform_real_distribution<float> evts(lo - 20, hi + 20);
+    std::vector<float> buf(model.kmer_count());
+    std::vector<bool> near(model.kmer_count());
+
+    for (float thresh : {-2.0f, -3.75f, -6.0f, -10.0f}) {
+        float window = model.prob_window(thresh);
+        u32 missed = 0, differ = 0;
+
+        for (u32 i = 0; i < 5000; i++) {
+            float evt = evts(rng);
+            const float *dense = model.event_match_probs(evt, buf.data());
+
+            std::fill(near.begin(), near.end(), false);
+            auto range = model.kmers_near(evt, window);
+            for (auto k = range.first; k != range.second; k++) near[*k] = true;
+
+            bool table = model.prob_table_row(evt) != NULL;
+            for (u32 k = 0; k < model.kmer_count(); k++) {
+                if (dense[k] >= thresh && !near[k]) missed++;
+                if (!table && model.event_match_prob(evt, k) != dense[k]) {
+                    differ++;
+                }
+            }
+        }
+
+        CHECK(missed == 0);
+        CHECK(differ == 0);
+    }
+}
+
+//Models with k-mers the mapper isn't compiled for aren't loaded
+static void test_kmer_len() {
+    std::string fname = "kmer_model_test_model.txt";
+    for (u8 k : {3, 4, 11}) {
+        std::ofstream out(fname);
+        out << "kmer\tlevel_mean\tlevel_stdv\n";
+        for (u32 i = 0; i < (1u << (2 * k)); i++) {
+            std::string kmer(k, 'A');
+            for (u8 j = 0; j < k; j++) kmer[j] = "ACGT"[(i >> (2 * j)) & 3];
+            out << kmer << "\t" << (60 + i % 64) << "\t2\n";
+        }
+        out.close();
+
+        KmerModel model(fname, true);
+        CHECK(model.is_loaded() == (k >= MIN_KMER_LEN && k <= MAX_KMER_LEN));
+        CHECK(!model.is_loaded() || model.kmer_count() == (1u << (2 * k)));
+    }
+    std::remove(fname.c_str());
+
+    KmerModel missing("kmer_model_test_missing.txt", true);
+    CHECK(!missing.is_loaded() && missing.kmer_count() == 0);
+}
+
+int main(int argc, char **argv) {
+    std::string model_fname = argc > 1 ? argv[1] 
+                                       : "uncalled/models/r94_5mers.txt";
+    KmerModel model(model_fname, true);
+    if (!model.is_loaded()) {
+        std::cerr << "Error: failed to load '" << model_fname << "'\n";
+        return 1;
+    }
+
+    test_kmer_len();
+    test_exact(model);
+    test_prob_table(model);
+    test_sparse_probs(model, 0);
+    test_sparse_probs(model, 0.01);
+
+    if (failures > 0) {
+        std::cerr << failures << " checks failed\n";
+        return 1;
+    }
+    std::cerr << "All k-mer model tests passed\n";
+    return 0;
+}
@@ -0,0 +1,111 @@
+/* MIT License
+ *
+ * Copyright (c) 2018 Sam Kovaka <skovaka@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include "kmer_probs.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define KMER_PROBS_X86
+#endif
+
+//-(d*d)/v - l, with d computed in single precision first. Squaring a 
+//float is exact in double, so this matches pow(d, 2)
+void kmer_probs_scalar(float evt, const float *means, const float *vars_x2, 
+                       const float *lognorm_denoms, u32 n, float *probs) {
+    for (u32 i = 0; i < n; i++) {
+        double d = evt - means[i];
+        probs[i] = (-(d * d) / vars_x2[i]) - lognorm_denoms[i];
+    }
+}
+
+#ifdef KMER_PROBS_X86
+
+//Four k-mers in double precision. Negating with the sign bit keeps 
+//zeros signed the same way as the scalar code
+__attribute__((target("avx2")))
+static inline __m128 probs4_avx2(__m128 d, __m128 v, __m128 l) {
+    __m256d dd = _mm256_cvtps_pd(d),
+            q = _mm256_div_pd(_mm256_mul_pd(dd, dd), _mm256_cvtps_pd(v));
+    q = _mm256_xor_pd(q, _mm256_set1_pd(-0.0));
+    return _mm256_cvtpd_ps(_mm256_sub_pd(q, _mm256_cvtps_pd(l)));
+}
+
+__attribute__((target("avx2")))
+static void kmer_probs_avx2(float evt, const float *means, const float *vars_x2, 
+                            const float *lognorm_denoms, u32 n, float *probs) {
+    __m256 e = _mm256_set1_ps(evt);
+    u32 i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256 d = _mm256_sub_ps(e, _mm256_load_ps(means + i)),
+               v = _mm256_load_ps(vars_x2 + i),
+               l = _mm256_load_ps(lognorm_denoms + i);
+
+        __m128 lo = probs4_avx2(_mm256_castps256_ps128(d), 
+                                _mm256_castps256_ps128(v), 
+                                _mm256_castps256_ps128(l)),
+               hi = probs4_avx2(_mm256_extractf128_ps(d, 1), 
+                                _mm256_extractf128_ps(v, 1), 
+                                _mm256_extractf128_ps(l, 1));
+
+        _mm256_storeu_ps(probs + i, _mm256_insertf128_ps(_mm256_castps128_ps256(lo), hi, 1));
+    }
+    kmer_probs_scalar(evt, means + i, vars_x2 + i, lognorm_denoms + i, n - i, probs + i);
+}
+
+//Eight k-mers in double precision. The masks select all eight lanes, so
+//the zero-masked conversions give the same results as the unmasked ones,
+//which GCC warns about since their pass-through operand is undefined
+__attribute__((target("avx512f")))
+static inline __m256 probs8_avx512(__m256 d, __m256 v, __m256 l) {
+    __m512d dd = _mm512_maskz_cvtps_pd(0xFF, d),
+            q = _mm512_div_pd(_mm512_mul_pd(dd, dd), _mm512_maskz_cvtps_pd(0xFF, v));
+    q = _mm512_castsi512_pd(_mm512_xor_si512(_mm512_castpd_si512(q), 
+                            _mm512_set1_epi64(0x8000000000000000ll)));
+    return _mm512_maskz_cvtpd_ps(0xFF, _mm512_sub_pd(q, _mm512_maskz_cvtps_pd(0xFF, l)));
+}
+
+__attribute__((target("avx512f")))
+static void kmer_probs_avx512(float evt, const float *means, const float *vars_x2, 
+                              const float *lognorm_denoms, u32 n, float *probs) {
+    __m256 e = _mm256_set1_ps(evt);
+    u32 i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256 d = _mm256_sub_ps(e, _mm256_load_ps(means + i)),
+               v = _mm256_load_ps(vars_x2 + i),
+               l = _mm256_load_ps(lognorm_denoms + i);
+        _mm256_storeu_ps(probs + i, probs8_avx512(d, v, l));
+    }
+    kmer_probs_scalar(evt, means + i, vars_x2 + i, lognorm_denoms + i, n - i, probs + i);
+}
+
+#endif
+
+KmerProbFn get_kmer_prob_fn() {
+    #ifdef KMER_PROBS_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) return kmer_probs_avx512;
+    if (__builtin_cpu_supports("avx2")) return kmer_probs_avx2;
+    #endif
+    return kmer_probs_scalar;
+}
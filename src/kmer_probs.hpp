@@ -0,0 +1,46 @@
+/* MIT License
+ *
+ * Copyright (c) 2018 Sam Kovaka <skovaka@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#ifndef INCL_KMER_PROBS
+#define INCL_KMER_PROBS
+
+#include "util.hpp"
+
+//Computes the log probability of an event matching each of n k-mers from 
+//their level means, doubled variances and log normal denominators. The
+//arrays must start on 64-byte boundaries. Every kernel computes in double
+//precision like KmerModel::event_match_prob, so they give identical results
+typedef void (*KmerProbFn)(float evt, 
+                           const float *means, 
+                           const float *vars_x2, 
+                           const float *lognorm_denoms, 
+                           u32 n, float *probs);
+
+void kmer_probs_scalar(float evt, const float *means, const float *vars_x2, 
+                       const float *lognorm_denoms, u32 n, float *probs);
+
+//Fastest kernel supported by the CPU we're running on
+KmerProbFn get_kmer_prob_fn();
+
+#endif
@@ -25,32 +25,29 @@
 #include "mapper.hpp"
 #include "params.hpp"
 
-u8 Mapper::PathBuffer::MAX_PATH_LEN = 0, 
-   Mapper::PathBuffer::TYPE_MASK = 0;
+u8 Mapper::PathBase::MAX_PATH_LEN = 0, 
+   Mapper::PathBase::TYPE_MASK = 0;
 
-u32 Mapper::PathBuffer::TYPE_ADDS[EventType::NUM_TYPES];
+u32 Mapper::PathBase::TYPE_ADDS[EventType::NUM_TYPES];
 
-Mapper::PathBuffer::PathBuffer()
+Mapper::PathBase::PathBase()
     : length_(0),
-      prob_sums_(new float[MAX_PATH_LEN+1]) {
+      prob_sums_(NULL) {
 }
 
-Mapper::PathBuffer::PathBuffer(const PathBuffer &p) {
-    std::memcpy(this, &p, sizeof(PathBuffer));
+Mapper::PathBase::PathBase(const PathBase &p) {
+    std::memcpy(this, &p, sizeof(PathBase));
 }
 
-void Mapper::PathBuffer::free_buffers() {
-    delete[] prob_sums_;
-}
-
-void Mapper::PathBuffer::make_source(Range &range, u16 kmer, float prob) {
+void Mapper::PathBase::make_source(u32 kmer, float prob, bool full_range) {
     length_ = 1;
     consec_stays_ = 0;
     event_types_ = 0;
     seed_prob_ = prob;
-    fm_range_ = range;
     kmer_ = kmer;
     sa_checked_ = false;
+    seq_ = kmer;
+    jump_len_ = full_range ? PARAMS.model.kmer_len() : 0;
 
     path_type_counts_[EventType::MATCH] = 1;
     path_type_counts_[EventType::STAY] = 0;
@@ -63,14 +60,12 @@ void Mapper::PathBuffer::make_source(Range &range, u16 kmer, float prob) {
 }
 
 
-void Mapper::PathBuffer::make_child(PathBuffer &p, 
-                                    Range &range,
-                                    u16 kmer, 
-                                    float prob, 
-                                    EventType type) {
+void Mapper::PathBase::make_child(PathBase &p, 
+                                  u32 kmer, 
+                                  float prob, 
+                                  EventType type) {
 
     length_ = p.length_ + (p.length_ <= MAX_PATH_LEN);
-    fm_range_ = range;
     kmer_ = kmer;
     sa_checked_ = p.sa_checked_;
     event_types_ = TYPE_ADDS[type] | (p.event_types_ >> TYPE_BITS);
@@ -80,6 +75,14 @@ void Mapper::PathBuffer::make_child(PathBuffer &p,
     path_type_counts_[type]++;
     total_match_len_ = p.total_match_len_ + (type==EventType::MATCH);
 
+    if (type == EventType::MATCH) {
+        seq_ = (p.seq_ << 2) | PARAMS.model.get_last_base(kmer);
+        jump_len_ = p.can_jump(JumpTable::MAX_LEN) ? p.jump_len_ + 1 : 0;
+    } else {
+        seq_ = p.seq_;
+        jump_len_ = p.jump_len_;
+    }
+
     if (length_ > MAX_PATH_LEN) {
         std::memcpy(prob_sums_, &(p.prob_sums_[1]), MAX_PATH_LEN * sizeof(float));
         prob_sums_[MAX_PATH_LEN] = prob_sums_[MAX_PATH_LEN-1] + prob;
@@ -93,30 +96,34 @@ void Mapper::PathBuffer::make_child(PathBuffer &p,
 
 }
 
-void Mapper::PathBuffer::invalidate() {
+void Mapper::PathBase::invalidate() {
     length_ = 0;
 }
 
-bool Mapper::PathBuffer::is_valid() const {
+bool Mapper::PathBase::is_valid() const {
     return length_ > 0;
 }
 
-u8 Mapper::PathBuffer::match_len() const {
+bool Mapper::PathBase::can_jump(u8 max_len) const {
+    return jump_len_ > 0 && jump_len_ < max_len;
+}
+
+u8 Mapper::PathBase::match_len() const {
     return path_type_counts_[EventType::MATCH];
 }
 
-u8 Mapper::PathBuffer::type_head() const {
+u8 Mapper::PathBase::type_head() const {
     return (event_types_ >> (TYPE_BITS*(MAX_PATH_LEN-2))) & TYPE_MASK;
 }
 
-u8 Mapper::PathBuffer::type_tail() const {
+u8 Mapper::PathBase::type_tail() const {
     return event_types_ & TYPE_MASK;
 }
 
-bool Mapper::PathBuffer::is_seed_valid(bool path_ended) const{
-    return (fm_range_.length() == 1 || 
+bool Mapper::PathBase::is_seed_valid(u64 range_len, bool path_ended) const{
+    return (range_len == 1 || 
                 (path_ended &&
-                 fm_range_.length() <= PARAMS.max_rep_copy &&
+                 range_len <= PARAMS.max_rep_copy &&
                  match_len() >= PARAMS.min_rep_len)) &&
 
            length_ >= PARAMS.seed_len &&
@@ -126,30 +133,58 @@ bool Mapper::PathBuffer::is_seed_valid(bool path_ended) const{
 }
 
 
-bool operator< (const Mapper::PathBuffer &p1, 
-                const Mapper::PathBuffer &p2) {
-    return p1.fm_range_ < p2.fm_range_ ||
-           (p1.fm_range_ == p2.fm_range_ && 
-            p1.seed_prob_ < p2.seed_prob_);
-}
+Mapper::Search::Search()
+    : index(NULL),
+      fmi(NULL),
+      bwa_fmi(NULL),
+      loc_offset(0),
+      coord32(true),
+      prev_size(0),
+      source_window(0) {}
 
 Mapper::Mapper()
-    : state_(State::INACTIVE) {
+    : state_(State::INACTIVE),
+      search_count_(0),
+      tid_(0) {
 
 
-    PathBuffer::MAX_PATH_LEN = PARAMS.seed_len;
+    PathBase::MAX_PATH_LEN = PARAMS.seed_len;
 
     for (u64 t = 0; t < EventType::NUM_TYPES; t++) {
-        PathBuffer::TYPE_ADDS[t] = t << ((PathBuffer::MAX_PATH_LEN-2)*TYPE_BITS);
+        PathBase::TYPE_ADDS[t] = t << ((PathBase::MAX_PATH_LEN-2)*TYPE_BITS);
     }
-    PathBuffer::TYPE_MASK = (u8) ((1 << TYPE_BITS) - 1);
+    PathBase::TYPE_MASK = (u8) ((1 << TYPE_BITS) - 1);
+
+    kmer_prob_buf_ = std::vector<float>(PARAMS.model.kmer_count());
+    kmer_probs_ = kmer_prob_buf_.data();
+
+    sparse_probs_ = false;
+    kmer_prob_stamps_ = std::vector<u32>(PARAMS.model.kmer_count(), 0);
+    prob_stamp_ = 0;
+    source_marks_ = std::vector<u64>((PARAMS.model.kmer_count() + 63) / 64, 0);
+
+    static_assert(MIN_KMER_LEN == 4 && MAX_KMER_LEN == 10, 
+                  "add_event_k must be instantiated for every k-mer length");
+
+    switch (PARAMS.model.kmer_len()) {
+        case 4:  add_event_fn_ = &Mapper::add_event_k<4>;  break;
+        case 5:  add_event_fn_ = &Mapper::add_event_k<5>;  break;
+        case 6:  add_event_fn_ = &Mapper::add_event_k<6>;  break;
+        case 7:  add_event_fn_ = &Mapper::add_event_k<7>;  break;
+        case 8:  add_event_fn_ = &Mapper::add_event_k<8>;  break;
+        case 9:  add_event_fn_ = &Mapper::add_event_k<9>;  break;
+        case 10: add_event_fn_ = &Mapper::add_event_k<10>; break;
+        //Other lengths are rejected when the model is loaded
+        default: add_event_fn_ = NULL;
+    }
+
+    //Paths are sized for the current index, which is acquired again 
+    //for each read so an unused mapper doesn't keep it loaded
+    update_index();
+    index_.reset();
 
-    kmer_probs_ = std::vector<float>(PARAMS.model.kmer_count());
-    prev_paths_ = std::vector<PathBuffer>(PARAMS.max_paths);
-    next_paths_ = std::vector<PathBuffer>(PARAMS.max_paths);
-    sources_added_ = std::vector<bool>(PARAMS.model.kmer_count(), false);
+    neighbor_masks_ = std::vector<u8>(PARAMS.max_paths, 0);
 
-    prev_size_ = 0;
     event_i_ = 0;
     seed_tracker_.reset();
 }
@@ -157,10 +192,81 @@ Mapper::Mapper()
 Mapper::Mapper(const Mapper &m) : Mapper() {}
 
 Mapper::~Mapper() {
+    for (Search &s : searches_) {
+        free_paths(s.paths32);
+        free_paths(s.paths64);
+    }
+}
 
-    for (u32 i = 0; i < next_paths_.size(); i++) {
-        next_paths_[i].free_buffers();
-        prev_paths_[i].free_buffers();
+//Allocates the path pools, with the probability sums of all paths in 
+//one buffer. Any huge page mode puts them on transparent huge pages
+template <typename T>
+void Mapper::init_paths(PathSet<T> &paths) {
+    typename PathSet<T>::Alloc alloc(PARAMS.huge_pages != HUGE_NONE);
+    typename PathSet<T>::Pool prev(alloc), next(alloc);
+    prev.resize(PARAMS.max_paths);
+    next.resize(PARAMS.max_paths);
+    paths.prev.swap(prev);
+    paths.next.swap(next);
+
+    u32 buf_len = PathBase::MAX_PATH_LEN + 1;
+    typename PathSet<T>::ProbBuf prob_buf(alloc);
+    prob_buf.resize(2 * PARAMS.max_paths * buf_len);
+    paths.prob_buf.swap(prob_buf);
+
+    for (u32 i = 0; i < PARAMS.max_paths; i++) {
+        paths.prev[i].prob_sums_ = &paths.prob_buf[(2 * i) * buf_len];
+        paths.next[i].prob_sums_ = &paths.prob_buf[(2 * i + 1) * buf_len];
+    }
+}
+
+template <typename T>
+void Mapper::free_paths(PathSet<T> &paths) {
+    typename PathSet<T>::ProbBuf().swap(paths.prob_buf);
+    typename PathSet<T>::Pool().swap(paths.prev);
+    typename PathSet<T>::Pool().swap(paths.next);
+}
+
+void Mapper::update_index() {
+    index_ = INDEX_REGISTRY.get();
+    set_search(searches_[0], *index_, 0);
+    search_count_ = 1;
+
+    //Event indexes are 32-bit, so seeds this far apart are never chained
+    if (index_->added != NULL) {
+        set_search(searches_[1], *index_->added, 
+                   index_->fmi->size() + UINT_MAX);
+        search_count_ = 2;
+    }
+}
+
+void Mapper::set_search(Search &s, const RefIndex &index, u64 loc_offset) {
+    s.index = &index;
+    s.fmi = &index.thread_fmi(tid_);
+    s.bwa_fmi = dynamic_cast<const BwaFMI *>(s.fmi);
+    s.loc_offset = loc_offset;
+    s.sources_added.resize(PARAMS.model.kmer_count(), false);
+    s.source_window = PARAMS.model.prob_window(index.get_source_prob());
+
+    //Rows go up to size(), and an empty range can start one past that.
+    //A new index may need the other coordinate width
+    s.coord32 = s.fmi->size() < UINT_MAX;
+    if (s.coord32 && s.paths32.prev.empty()) {
+        free_paths(s.paths64);
+        init_paths(s.paths32);
+    } else if (!s.coord32 && s.paths64.prev.empty()) {
+        free_paths(s.paths32);
+        init_paths(s.paths64);
+    }
+}
+
+void Mapper::set_thread(u16 tid) {
+    tid_ = tid;
+    if (!index_) return;
+    for (u8 i = 0; i < search_count_; i++) {
+        Search &s = searches_[i];
+        s.fmi = &s.index->thread_fmi(tid_);
+        s.bwa_fmi = dynamic_cast<const BwaFMI *>(s.fmi);
     }
 }
 
@@ -171,6 +277,7 @@ ReadBuffer &Mapper::get_read() {
 void Mapper::deactivate() {
     state_ = State::INACTIVE;
     reset_ = false;
+    index_.reset();
 }
 
 Paf Mapper::map_read() {
@@ -222,7 +329,11 @@ void Mapper::reset() {
     seeds_out_.close();
     #endif
 
-    prev_size_ = 0;
+    update_index();
+
+    for (Search &s : searches_) {
+        s.prev_size = 0;
+    }
     event_i_ = 0;
     reset_ = false;
     last_chunk_ = false;
@@ -248,7 +359,9 @@ bool Mapper::finished() const {
 
 void Mapper::skip_events(u32 n) {
     event_i_ += n;
-    prev_size_ = 0;
+    for (Search &s : searches_) {
+        s.prev_size = 0;
+    }
 }
 
 void Mapper::request_reset() {
@@ -363,37 +476,158 @@ bool Mapper::map_chunk() {
 }
 
 bool Mapper::add_event(float event) {
+    if (add_event_fn_ == NULL) {
+        state_ = State::FAILURE;
+        return true;
+    }
+    return (this->*add_event_fn_)(event);
+}
+
+template <u8 K>
+bool Mapper::add_event_k(float event) {
 
     if (reset_ || event_i_ >= PARAMS.max_events_proc) {
         state_ = State::FAILURE;
         return true;
     }
 
-    Range prev_range;
-    u16 prev_kmer;
+    for (u8 i = 0; i < search_count_; i++) {
+        Search &s = searches_[i];
+        s.near_kmers = PARAMS.model.kmers_near(event, s.source_window);
+    }
+
+    sparse_probs_ = use_sparse_probs();
+    if (sparse_probs_) {
+        set_sparse_probs<K>(event);
+    } else {
+        kmer_probs_ = PARAMS.model.event_match_probs(event, kmer_prob_buf_.data());
+    }
+
+    //Seeds from every index are added to the same tracker
+    for (u8 i = 0; i < search_count_; i++) {
+        Search &s = searches_[i];
+        if (s.bwa_fmi != NULL) {
+            if (s.coord32) extend_paths<K>(s, s.paths32, *s.bwa_fmi);
+            else           extend_paths<K>(s, s.paths64, *s.bwa_fmi);
+        } else {
+            if (s.coord32) extend_paths<K>(s, s.paths32, *s.fmi);
+            else           extend_paths<K>(s, s.paths64, *s.fmi);
+        }
+    }
+
+    //Update event index
+    event_i_++;
+
+    SeedGroup sg = seed_tracker_.get_final();
+
+    if (sg.is_valid()) {
+        state_ = State::SUCCESS;
+        set_ref_loc(sg);
+
+        #ifdef DEBUG_SEEDS
+        for (u8 i = 0; i < search_count_; i++) {
+            Search &s = searches_[i];
+            for (u32 pi = 0; pi < s.prev_size; pi++) {
+                if (s.coord32) print_debug_seeds(s, s.paths32.prev[pi]);
+                else           print_debug_seeds(s, s.paths64.prev[pi]);
+            }
+        }
+        #endif
+
+        return true;
+    }
+
+    return false;
+}
+
+bool Mapper::use_sparse_probs() const {
+    u32 kmer_count = PARAMS.model.kmer_count(),
+        path_kmers = 0;
+
+    for (u8 i = 0; i < search_count_; i++) {
+        const Search &s = searches_[i];
+
+        //Each child can be followed by two sources
+        u64 max_next = u64(s.prev_size) * (ALPH_SIZE + 1) * 3 + kmer_count;
+        if (max_next >= PARAMS.max_paths) return false;
+
+        path_kmers += s.prev_size * (ALPH_SIZE + 1) + 
+                      (s.near_kmers.second - s.near_kmers.first);
+    }
+
+    return path_kmers * SPARSE_KMER_FRAC <= kmer_count;
+}
+
+template <u8 K>
+void Mapper::set_sparse_probs(float event) {
+    //Table rows already hold every k-mer
+    kmer_probs_ = PARAMS.model.prob_table_row(event);
+    if (kmer_probs_ != NULL) return;
+
+    kmer_probs_ = kmer_prob_buf_.data();
+    if (++prob_stamp_ == 0) {
+        std::fill(kmer_prob_stamps_.begin(), kmer_prob_stamps_.end(), 0);
+        prob_stamp_ = 1;
+    }
+
+    for (u8 i = 0; i < search_count_; i++) {
+        Search &s = searches_[i];
+        for (u32 pi = 0; pi < s.prev_size; pi++) {
+            u32 kmer = s.coord32 ? s.paths32.prev[pi].kmer_ 
+                                 : s.paths64.prev[pi].kmer_;
+            set_kmer_prob(kmer, event);
+            for (u8 b = 0; b < ALPH_SIZE; b++) {
+                set_kmer_prob(KmerLen<K>::get_neighbor(kmer, b), event);
+            }
+        }
+
+        for (auto k = s.near_kmers.first; k != s.near_kmers.second; k++) {
+            set_kmer_prob(*k, event);
+        }
+    }
+}
+
+void Mapper::set_kmer_prob(u32 kmer, float event) {
+    if (kmer_prob_stamps_[kmer] != prob_stamp_) {
+        kmer_prob_stamps_[kmer] = prob_stamp_;
+        kmer_prob_buf_[kmer] = PARAMS.model.event_match_prob(event, kmer);
+    }
+}
+
+template <u8 K, typename T, typename FMI>
+void Mapper::extend_paths(Search &s, PathSet<T> &paths, const FMI &fmi) {
+
+    const RefIndex &index = *s.index;
+    u8 max_jump = index.jump_table.max_len();
+    BasicRange<T> prev_range;
+    u32 prev_kmer;
     float evpr_thresh;
     bool child_found;
 
 
-    auto next_path = next_paths_.begin();
+    auto next_path = paths.next.begin();
 
-    for (u16 kmer = 0; kmer < PARAMS.model.kmer_count(); kmer++) {
-        kmer_probs_[kmer] = PARAMS.model.event_match_prob(event, kmer);
-    }
-    
     //Find neighbors of previous nodes
-    for (u32 pi = 0; pi < prev_size_; pi++) {
-        if (!prev_paths_[pi].is_valid()) {
+    for (u32 pi = 0; pi < s.prev_size; pi++) {
+
+        //Gather and prefetch the queries of the next batch of paths
+        if (pi % PREFETCH_BATCH == 0) {
+            u32 batch_end = pi + PREFETCH_BATCH;
+            prefetch_paths<K>(s, paths.prev.data(), pi, 
+                           batch_end < s.prev_size ? batch_end : s.prev_size, fmi);
+        }
+
+        if (!paths.prev[pi].is_valid()) {
             continue;
         }
 
         child_found = false;
 
-        PathBuffer &prev_path = prev_paths_[pi];
-        Range &prev_range = prev_path.fm_range_;
+        PathBuffer<T> &prev_path = paths.prev[pi];
+        BasicRange<T> &prev_range = prev_path.fm_range_;
         prev_kmer = prev_path.kmer_;
 
-        evpr_thresh = PARAMS.get_prob_thresh(prev_range.length());
+        evpr_thresh = index.get_prob_thresh(prev_range.length());
         //evpr_thresh = PARAMS.get_path_thresh(prev_path.total_match_len_);
 
         if (prev_path.consec_stays_ < PARAMS.max_consec_stay && 
@@ -405,25 +639,46 @@ bool Mapper::add_event(float event) {
                                   kmer_probs_[prev_kmer], 
                                   EventType::STAY);
             #ifdef FM_PROFILER
-            fm_profiler_.add_range(prev_range);
+            fm_profiler_.add_range(Range(prev_range));
             #endif
 
             child_found = true;
 
-            if (++next_path == next_paths_.end()) {
+            if (++next_path == paths.next.end()) {
                 break;
             }
         }
 
+        //Neighbors which passed the threshold in prefetch_paths
+        u8 next_mask = neighbor_masks_[pi],
+           next_count = __builtin_popcount(next_mask);
+
+        //Short full ranges are read from the jump table, otherwise 
+        //compute all ranges at once if more than one is needed
+        bool jump = prev_path.can_jump(max_jump);
+        BasicRange<T> next_ranges[ALPH_SIZE];
+        if (next_count > 1 && !jump) {
+            fmi.get_neighbors(prev_range, next_ranges);
+        }
+
         //Add all the neighbors
         for (u8 b = 0; b < ALPH_SIZE; b++) {
-            u16 next_kmer = PARAMS.model.get_neighbor(prev_kmer, b);
-
-            if (kmer_probs_[next_kmer] < evpr_thresh) {
+            if (!(next_mask & (1 << b))) {
                 continue;
             }
 
-            Range next_range = PARAMS.fmi.get_neighbor(prev_range, b);
+            u32 next_kmer = KmerLen<K>::get_neighbor(prev_kmer, b);
+
+            BasicRange<T> next_range;
+            if (jump) {
+                next_range = BasicRange<T>(
+                    index.jump_table.get(prev_path.jump_len_ + 1, 
+                                          (prev_path.seq_ << 2) | b));
+            } else if (next_count > 1) {
+                next_range = next_ranges[b];
+            } else {
+                next_range = fmi.get_neighbor(prev_range, b);
+            }
 
             if (!next_range.is_valid()) {
                 continue;
@@ -437,12 +692,12 @@ bool Mapper::add_event(float event) {
 
 
             #ifdef FM_PROFILER
-            fm_profiler_.add_range(next_range);
+            fm_profiler_.add_range(Range(next_range));
             #endif
 
             child_found = true;
 
-            if (++next_path == next_paths_.end()) {
+            if (++next_path == paths.next.end()) {
                 break;
             }
         }
@@ -452,84 +707,85 @@ bool Mapper::add_event(float event) {
 
             //Add seeds for non-extended paths
             //Extended paths will be updated after sources filled in
-            update_seeds(prev_path, true);
+            update_seeds(s, prev_path, true);
 
             #ifdef DEBUG_SEEDS
-            print_debug_seeds(prev_path);
+            print_debug_seeds(s, prev_path);
             #endif
         }
 
-        if (next_path == next_paths_.end()) {
+        if (next_path == paths.next.end()) {
             break;
         }
     }
 
     //Create sources between gaps
-    if (next_path != next_paths_.begin()) {
+    if (next_path != paths.next.begin()) {
 
-        u32 next_size = next_path - next_paths_.begin();
+        u32 next_size = next_path - paths.next.begin();
 
-        pdqsort(next_paths_.begin(), next_path);
-        //std::sort(next_paths_.begin(), next_path);
+        pdqsort(paths.next.begin(), next_path);
+        //std::sort(paths.next.begin(), next_path);
 
-        u16 source_kmer;
-        prev_kmer = PARAMS.model.kmer_count(); 
+        u32 source_kmer;
+        prev_kmer = KmerLen<K>::COUNT; 
 
-        Range unchecked_range, source_range;
+        BasicRange<T> unchecked_range, source_range;
 
         for (u32 i = 0; i < next_size; i++) {
-            source_kmer = next_paths_[i].kmer_;
+            source_kmer = paths.next[i].kmer_;
 
             //Add source for beginning of kmer range
             if (source_kmer != prev_kmer &&
-                next_path != next_paths_.end() &&
-                kmer_probs_[source_kmer] >= PARAMS.get_source_prob()) {
+                next_path != paths.next.end() &&
+                kmer_probs_[source_kmer] >= index.get_source_prob()) {
 
-                sources_added_[source_kmer] = true;
+                s.sources_added[source_kmer] = true;
 
-                source_range = Range(PARAMS.kmer_fmranges[source_kmer].start_,
-                                     next_paths_[i].fm_range_.start_ - 1);
+                source_range = BasicRange<T>(index.kmer_fmranges[source_kmer].start_,
+                                     paths.next[i].fm_range_.start_ - 1);
 
                 if (source_range.is_valid()) {
                     next_path->make_source(source_range,
                                            source_kmer,
-                                           kmer_probs_[source_kmer]);
+                                           kmer_probs_[source_kmer],
+                                           false);
                     next_path++;
 
                     #ifdef FM_PROFILER
-                    fm_profiler_.add_range(source_range);
+                    fm_profiler_.add_range(Range(source_range));
                     #endif
                 }                                    
 
-                unchecked_range = Range(next_paths_[i].fm_range_.end_ + 1,
-                                        PARAMS.kmer_fmranges[source_kmer].end_);
+                unchecked_range = BasicRange<T>(paths.next[i].fm_range_.end_ + 1,
+                                        index.kmer_fmranges[source_kmer].end_);
             }
 
             prev_kmer = source_kmer;
 
-            //Range next_range = next_paths_[i].fm_range_;
+            //Range next_range = paths.next[i].fm_range_;
 
             //Remove paths with duplicate ranges
             //Best path will be listed last
-            if (i < next_size - 1 && next_paths_[i].fm_range_ == next_paths_[i+1].fm_range_) {
-                next_paths_[i].invalidate();
+            if (i < next_size - 1 && paths.next[i].fm_range_ == paths.next[i+1].fm_range_) {
+                paths.next[i].invalidate();
                 continue;
             }
 
             //Start source after current path
             //TODO: check if theres space for a source here, instead of after extra work?
-            if (next_path != next_paths_.end() &&
-                kmer_probs_[source_kmer] >= PARAMS.get_source_prob()) {
+            if (next_path != paths.next.end() &&
+                kmer_probs_[source_kmer] >= index.get_source_prob()) {
                 
                 source_range = unchecked_range;
                 
                 //Between this and next path ranges
-                if (i < next_size - 1 && source_kmer == next_paths_[i+1].kmer_) {
+                if (i < next_size - 1 && source_kmer == paths.next[i+1].kmer_) {
 
-                    source_range.end_ = next_paths_[i+1].fm_range_.start_ - 1;
+                    source_range.end_ = paths.next[i+1].fm_range_.start_ - 1;
 
-                    if (unchecked_range.start_ <= next_paths_[i+1].fm_range_.end_) {
-                        unchecked_range.start_ = next_paths_[i+1].fm_range_.end_ + 1;
+                    if (unchecked_range.start_ <= paths.next[i+1].fm_range_.end_) {
+                        unchecked_range.start_ = paths.next[i+1].fm_range_.end_ + 1;
                     }
                 }
 
@@ -538,33 +794,30 @@ bool Mapper::add_event(float event) {
 
                     next_path->make_source(source_range,
                                            source_kmer,
-                                           kmer_probs_[source_kmer]);
+                                           kmer_probs_[source_kmer],
+                                           false);
                     next_path++;
 
                     #ifdef FM_PROFILER
-                    fm_profiler_.add_range(source_range);
+                    fm_profiler_.add_range(Range(source_range));
                     #endif
                 }
             }
 
-            update_seeds(next_paths_[i], false);
+            update_seeds(s, paths.next[i], false);
         }
     }
 
-    for (u16 kmer = 0; 
-         kmer < PARAMS.model.kmer_count() && 
-            next_path != next_paths_.end(); 
-         kmer++) {
-
-        Range next_range = PARAMS.kmer_fmranges[kmer];
+    auto add_source = [&](u32 kmer) {
+        BasicRange<T> next_range(index.kmer_fmranges[kmer]);
 
-        if (!sources_added_[kmer] && 
-            kmer_probs_[kmer] >= PARAMS.get_source_prob() &&
-            next_path != next_paths_.end() &&
+        if (!s.sources_added[kmer] && 
+            kmer_probs_[kmer] >= index.get_source_prob() &&
+            next_path != paths.next.end() &&
             next_range.is_valid()) {
 
             //TODO: don't write to prob buffer here to speed up source loop
-            next_path->make_source(next_range, kmer, kmer_probs_[kmer]);
+            next_path->make_source(next_range, kmer, kmer_probs_[kmer], true);
             next_path++;
 
             #ifdef FM_PROFILER
@@ -572,44 +825,94 @@ bool Mapper::add_event(float event) {
             #endif
 
         } else {
-            sources_added_[kmer] = false;
+            s.sources_added[kmer] = false;
+        }
+    };
+
+    if (!sparse_probs_) {
+        for (u32 kmer = 0; 
+             kmer < KmerLen<K>::COUNT && 
+                next_path != paths.next.end(); 
+             kmer++) {
+            add_source(kmer);
+        }
+
+    //Only k-mers near the event can pass the source threshold, so only 
+    //they can be marked in sources_added. They're added in k-mer order 
+    //like above, and the buffer can't fill up when sparse
+    } else {
+        for (auto k = s.near_kmers.first; k != s.near_kmers.second; k++) {
+            source_marks_[*k >> 6] |= u64(1) << (*k & 63);
+        }
+        for (u32 w = 0; w < source_marks_.size(); w++) {
+            while (source_marks_[w] != 0) {
+                add_source((w << 6) | __builtin_ctzll(source_marks_[w]));
+                source_marks_[w] &= source_marks_[w] - 1;
+            }
         }
     }
 
-    prev_size_ = next_path - next_paths_.begin();
-    prev_paths_.swap(next_paths_);
+    s.prev_size = next_path - paths.next.begin();
+    paths.prev.swap(paths.next);
+}
 
-    //Update event index
-    event_i_++;
+//First pass of path extension: finds which neighbors of each path pass
+//the event threshold and prefetches their FM occurrences, so the cache 
+//misses for a batch overlap instead of serializing the path loop
+template <u8 K, typename T, typename FMI>
+void Mapper::prefetch_paths(const Search &s, PathBuffer<T> *paths, 
+                            u32 start, u32 end, const FMI &fmi) {
+    const RefIndex &index = *s.index;
+    u8 max_jump = index.jump_table.max_len();
 
-    SeedGroup sg = seed_tracker_.get_final();
+    for (u32 pi = start; pi < end; pi++) {
+        PathBuffer<T> &p = paths[pi];
+        if (!p.is_valid()) {
+            continue;
+        }
 
-    if (sg.is_valid()) {
-        state_ = State::SUCCESS;
-        set_ref_loc(sg);
+        float evpr_thresh = index.get_prob_thresh(p.fm_range_.length());
 
-        #ifdef DEBUG_SEEDS
-        for (u32 pi = 0; pi < prev_size_; pi++) {
-            print_debug_seeds(prev_paths_[pi]);
+        u8 mask = 0;
+        for (u8 b = 0; b < ALPH_SIZE; b++) {
+            u32 next_kmer = KmerLen<K>::get_neighbor(p.kmer_, b);
+            mask |= (kmer_probs_[next_kmer] >= evpr_thresh) << b;
         }
-        #endif
+        neighbor_masks_[pi] = mask;
 
-        return true;
-    }
+        if (mask == 0) {
+            continue;
+        }
 
-    return false;
+        if (p.can_jump(max_jump)) {
+            index.jump_table.prefetch(p.jump_len_, p.seq_);
+        } else {
+            fmi.prefetch(p.fm_range_);
+        }
+    }
 }
 
-void Mapper::update_seeds(PathBuffer &p, bool path_ended) {
+template <typename T>
+void Mapper::update_seeds(const Search &s, PathBuffer<T> &p, bool path_ended) {
 
     if (p.is_seed_valid(path_ended)) {
 
         p.sa_checked_ = true;
 
-        for (u64 s = p.fm_range_.start_; s <= p.fm_range_.end_; s++) {
+        //Every copy is within a long repeat, so locating them can't lead 
+        //to a confident mapping
+        if (p.fm_range_.length() > 1 &&
+            s.index->repeat_mask.contains(p.fm_range_.start_, p.fm_range_.end_)) {
+            return;
+        }
+
+        seed_locs_.resize(p.fm_range_.length());
+        s.fmi->sa_range(p.fm_range_.start_, p.fm_range_.end_, seed_locs_.data());
+
+        for (u64 loc : seed_locs_) {
 
             //Reverse the reference coords so they both go L->R
-            u64 ref_en = PARAMS.fmi.size() - PARAMS.fmi.sa(s) + 1;
+            u64 ref_en = s.loc_offset + s.fmi->size() - loc + 1;
 
             seed_tracker_.add_seed(ref_en, p.match_len(), event_i_ - path_ended);
         }
@@ -617,29 +920,30 @@ void Mapper::update_seeds(PathBuffer &p, bool path_ended) {
 }
 
 #ifdef DEBUG_SEEDS
-void Mapper::print_debug_seeds(PathBuffer &p) {
+template <typename T>
+void Mapper::print_debug_seeds(const Search &search, PathBuffer<T> &p) {
+    const FMIndex *fmi = search.fmi;
 
     if (!p.is_seed_valid(true)) return;
 
     for (u64 s = p.fm_range_.start_; s <= p.fm_range_.end_; s++) {
         //Reverse the reference coords so they both go L->R
-        u64 ref_en = PARAMS.fmi.size() - (PARAMS.fmi.sa(s) + 1);
+        u64 ref_en = fmi->size() - (fmi->sa(s) + 1);
 
-        bool fwd = ref_en < PARAMS.fmi.size() / 2;
+        bool fwd = fmi->is_double_stranded() && ref_en < fmi->size() / 2;
 
         u64 sa_st;
         if (fwd) sa_st = ref_en - (p.match_len() + PARAMS.model.kmer_len() - 1)  + 1;
-        else     sa_st = PARAMS.fmi.size() - ref_en - 1;
+        else     sa_st = fmi->size() - ref_en - 1;
 
-        std::string rf_name;
-        u64 rf_st;
-        PARAMS.fmi.translate_loc(sa_st, rf_name, rf_st);
+        u64 rf_st = 0;
+        i32 rf_id = fmi->translate_loc(sa_st, rf_st);
 
-        if (rf_st > PARAMS.fmi.size()) {
+        if (rf_st > fmi->size()) {
             rf_st = 0;
         }
           
-        seeds_out_ << rf_name << "\t"
+        seeds_out_ << (rf_id >= 0 ? fmi->get_names()->get_name(rf_id).c_str() : "*") << "\t"
                    << rf_st << "\t"
                    << (rf_st + p.match_len() + PARAMS.model.kmer_len() - 1) << "\t"
                    << event_i_ << "\t"
@@ -649,22 +953,30 @@ void Mapper::print_debug_seeds(PathBuffer &p) {
 #endif
 
 void Mapper::set_ref_loc(const SeedGroup &seeds) {
-    bool fwd = seeds.ref_st_ < PARAMS.fmi.size() / 2;
+    //Seeds from the added index are offset past the main index
+    u8 i = search_count_ - 1;
+    while (i > 0 && seeds.ref_en_.end_ <= searches_[i].loc_offset) i--;
+    const FMIndex *fmi = searches_[i].fmi;
+    u64 ref_st = seeds.ref_st_ - searches_[i].loc_offset,
+        ref_en = seeds.ref_en_.end_ - searches_[i].loc_offset;
+
+    //A forward strand index only matches reads from the reverse strand
+    bool fwd = fmi->is_double_stranded() && ref_st < fmi->size() / 2;
 
     u64 sa_st;
-    if (fwd) sa_st = seeds.ref_st_;
-    else      sa_st = PARAMS.fmi.size() - (seeds.ref_en_.end_ + PARAMS.model.kmer_len() - 1);
+    if (fwd) sa_st = ref_st;
+    else      sa_st = fmi->size() - (ref_en + PARAMS.model.kmer_len() - 1);
     
-    std::string rf_name;
     u64 rd_st = event_detector_.event_to_bp(seeds.evt_st_),
         rd_en = event_detector_.event_to_bp(seeds.evt_en_ + PARAMS.seed_len, true),
-        rf_st,
-        rf_len = PARAMS.fmi.translate_loc(sa_st, rf_name, rf_st), //sets rf_st
-        rf_en = rf_st + (seeds.ref_en_.end_ - seeds.ref_st_ + PARAMS.model.kmer_len());
+        rf_st = 0;
+    i32 rf_id = fmi->translate_loc(sa_st, rf_st); //sets rf_st
+    u64 rf_en = rf_st + (ref_en - ref_st + PARAMS.model.kmer_len());
 
     u16 match_count = seeds.total_len_ + PARAMS.model.kmer_len() - 1;
 
-    read_.loc_.set_mapped(rd_st, rd_en, rf_name, rf_st, rf_en, rf_len, fwd, match_count);
+    read_.loc_.set_mapped(rd_st, rd_en, fmi->get_names(), rf_id, 
+                          rf_st, rf_en, fwd, match_count);
 }
 
 
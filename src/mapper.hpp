@@ -26,6 +26,8 @@
 
 #include <iostream>
 #include <vector>
+#include "ref_index.hpp"
+#include "huge_pages.hpp"
 #include "bwa_fmi.hpp"
 #include "kmer_model.hpp"
 #include "normalizer.hpp"
@@ -76,6 +78,9 @@ class Mapper {
     ReadBuffer &get_read();
     void deactivate();
 
+    //Searches the index copy local to a mapper thread
+    void set_thread(u16 tid);
+
     #ifdef FM_PROFILER
     FMProfiler fm_profiler_;
     #endif
@@ -85,39 +90,48 @@ class Mapper {
     enum EventType { MATCH, STAY, NUM_TYPES };
     static const u8 TYPE_BITS = 1;
 
-    class PathBuffer {
+    //Number of paths whose FM queries are prefetched at once
+    static const u32 PREFETCH_BATCH = 64;
+
+    //Probabilities are only computed for k-mers next to live paths and 
+    //near the event when they're at most this fraction of all k-mers
+    static const u32 SPARSE_KMER_FRAC = 4;
+
+    //Path state that doesn't depend on the FM coordinate width
+    class PathBase {
         public:
-        PathBuffer();
-        PathBuffer(const PathBuffer &p);
+        PathBase();
+        PathBase(const PathBase &p);
 
-        void make_source(Range &range, 
-                         u16 kmer, 
-                         float prob);
+        void make_source(u32 kmer, 
+                         float prob,
+                         bool full_range);
 
-        void make_child(PathBuffer &p, 
-                        Range &range, 
-                        u16 kmer, 
+        void make_child(PathBase &p, 
+                        u32 kmer, 
                         float prob, 
                         EventType type);
 
         void invalidate();
         bool is_valid() const;
-        bool is_seed_valid(bool has_children) const;
+        bool is_seed_valid(u64 range_len, bool has_children) const;
+
+        //True if the next ranges can be read from a jump table
+        //storing sequences up to max_len
+        bool can_jump(u8 max_len) const;
 
         u8 type_head() const;
         u8 type_tail() const;
         u8 match_len() const;
 
-        void free_buffers();
         void print() const;
 
         static u8 MAX_PATH_LEN, TYPE_MASK;
         static u32 TYPE_ADDS[EventType::NUM_TYPES];
 
-        Range fm_range_;
         u8 length_,
             consec_stays_;
-        u16 kmer_;
+        u32 kmer_;
         u16 total_match_len_;
 
         float seed_prob_;
@@ -127,15 +141,128 @@ class Mapper {
         u8 path_type_counts_[EventType::NUM_TYPES];
 
         bool sa_checked_;
+
+        //Sequence matched so far, if fm_range_ is its full range and
+        //it is in the jump table. jump_len_ is 0 otherwise
+        u32 seq_;
+        u8 jump_len_;
     };
 
-    friend bool operator< (const PathBuffer &p1, const PathBuffer &p2);
+    //Path with an FM range of 32-bit or 64-bit coordinates
+    template <typename T>
+    class PathBuffer : public PathBase {
+        public:
 
-    private:
+        void make_source(BasicRange<T> &range, 
+                         u32 kmer, 
+                         float prob,
+                         bool full_range) {
+            fm_range_ = range;
+            PathBase::make_source(kmer, prob, full_range);
+        }
+
+        void make_child(PathBuffer &p, 
+                        BasicRange<T> &range, 
+                        u32 kmer, 
+                        float prob, 
+                        EventType type) {
+            fm_range_ = range;
+            PathBase::make_child(p, kmer, prob, type);
+        }
+
+        bool is_seed_valid(bool has_children) const {
+            return PathBase::is_seed_valid(fm_range_.length(), has_children);
+        }
+
+        bool operator< (const PathBuffer &p) const {
+            return fm_range_ < p.fm_range_ ||
+                   (fm_range_ == p.fm_range_ && 
+                    seed_prob_ < p.seed_prob_);
+        }
+
+        BasicRange<T> fm_range_;
+    };
+
+    template <typename T>
+    struct PathSet {
+        typedef ThpAllocator< PathBuffer<T> > Alloc;
+        typedef std::vector< PathBuffer<T>, Alloc > Pool;
+        typedef std::vector< float, ThpAllocator<float> > ProbBuf;
+        Pool prev, next;
+        ProbBuf prob_buf;
+    };
+
+    //Paths through one index. Reads are searched in the main index and
+    //in the index of sequences added to it, if there is one
+    struct Search {
+        const RefIndex *index;
+        const FMIndex *fmi;
+        const BwaFMI *bwa_fmi;
+
+        //Added to located positions, so seeds from every index can go 
+        //in one seed tracker without being chained together
+        u64 loc_offset;
 
+        //Only one is used, 32-bit if the index is small enough
+        bool coord32;
+        PathSet<u32> paths32;
+        PathSet<u64> paths64;
+        u32 prev_size;
+
+        //K-mers whose sources were added between other paths' ranges
+        std::vector<bool> sources_added;
+
+        //Max distance from the event of k-mers which pass the source 
+        //threshold, and those k-mers for the current event if sparse
+        float source_window;
+        std::pair<KmerModel::level_itr, KmerModel::level_itr> near_kmers;
+
+        Search();
+    };
+
+    static const u8 MAX_SEARCHES = 2;
+
+    //K is the model's k-mer length, so k-mer masks are constants. FMI is
+    //the index's own type if it has a fast path, so its queries are 
+    //direct calls, or FMIndex for other layouts
+    template <u8 K, typename T, typename FMI>
+    void extend_paths(Search &s, PathSet<T> &paths, const FMI &fmi);
+
+    template <u8 K, typename T, typename FMI>
+    void prefetch_paths(const Search &s, PathBuffer<T> *paths, 
+                        u32 start, u32 end, const FMI &fmi);
+
+    template <typename T>
+    void update_seeds(const Search &s, PathBuffer<T> &p, bool has_children);
+
+    template <typename T>
+    void init_paths(PathSet<T> &paths);
+
+    template <typename T>
+    void free_paths(PathSet<T> &paths);
+
+    //Switches to the current index from INDEX_REGISTRY
+    void update_index();
+    void set_search(Search &s, const RefIndex &index, u64 loc_offset);
+
+    //Calls add_event_k for the model's k-mer length
     bool add_event(float event);
 
-    void update_seeds(PathBuffer &p, bool has_children);
+    template <u8 K>
+    bool add_event_k(float event);
+
+    //Instance of add_event_k chosen when the mapper is created, or NULL 
+    //if the model's k-mer length isn't supported
+    typedef bool (Mapper::*AddEventFn)(float);
+    AddEventFn add_event_fn_;
+
+    //Sparse if few enough paths are alive that they, and sources added
+    //from every k-mer, can't fill the path buffers
+    bool use_sparse_probs() const;
+
+    template <u8 K>
+    void set_sparse_probs(float event);
+    void set_kmer_prob(u32 kmer, float event);
 
     void set_ref_loc(const SeedGroup &seeds);
 
@@ -148,18 +275,35 @@ class Mapper {
     //u32 read_num_;
     bool last_chunk_, reset_;
     State state_;
-    std::vector<float> kmer_probs_;
-    std::vector<PathBuffer> prev_paths_, next_paths_;
-    std::vector<bool> sources_added_;
-    u32 prev_size_,
-        event_i_,
+
+    //Index used for the current read, kept until the next read starts
+    IndexRegistry::Ptr index_;
+    Search searches_[MAX_SEARCHES];
+    u8 search_count_;
+    u16 tid_;
+    //Probabilities of the current event, either in kmer_prob_buf_ or 
+    //in the model's probability table
+    std::vector<float> kmer_prob_buf_;
+    const float *kmer_probs_;
+
+    //If sparse, kmer_prob_buf_ entries are only set for k-mers whose 
+    //stamp matches prob_stamp_
+    bool sparse_probs_;
+    std::vector<u32> kmer_prob_stamps_;
+    u32 prob_stamp_;
+    std::vector<u64> source_marks_;
+
+    std::vector<u8> neighbor_masks_;
+    std::vector<u64> seed_locs_;
+    u32 event_i_,
         chunk_i_;
     Timer chunk_timer_, map_timer_;
     float map_time_, wait_time_;
 
     #ifdef DEBUG_SEEDS
     std::ofstream seeds_out_;
-    void print_debug_seeds(PathBuffer &p);
+    template <typename T>
+    void print_debug_seeds(const Search &s, PathBuffer<T> &p);
     #endif
 
 };
@@ -0,0 +1,134 @@
+/* MIT License
+ *
+ * Copyright (c) 2018 Sam Kovaka <skovaka@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <cstdlib>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+#include "numa.hpp"
+
+//Nodes that can be set in a single-word mbind mask
+static const u32 MAX_NODES = 64;
+
+static const std::string NODE_DIR = "/sys/devices/system/node/";
+
+const char *numa_mode_name(NumaMode mode) {
+    switch (mode) {
+        case NUMA_AUTO:       return "auto";
+        case NUMA_INTERLEAVE: return "interleave";
+        case NUMA_REPLICATE:  return "replicate";
+        default:              return "off";
+    }
+}
+
+//Parses sysfs lists such as "0-3,8-11"
+static std::vector<u32> read_list(const std::string &fname) {
+    std::vector<u32> ret;
+    std::ifstream in(fname);
+    std::string range;
+    while (std::getline(in, range, ',')) {
+        u32 st, en;
+        char dash;
+        std::istringstream ss(range);
+        if (!(ss >> st)) break;
+        if (!(ss >> dash >> en)) en = st;
+        for (u32 i = st; i <= en; i++) ret.push_back(i);
+    }
+    return ret;
+}
+
+u32 numa_node_count() {
+    static u32 count = 0;
+    if (count == 0) {
+        std::vector<u32> nodes = read_list(NODE_DIR + "online");
+        count = nodes.empty() ? 1 : nodes.back() + 1;
+        if (count > MAX_NODES) count = MAX_NODES;
+    }
+    return count;
+}
+
+bool numa_bind(void *addr, u64 len, i32 node) {
+    if (node == NUMA_ANY || numa_node_count() < 2) return true;
+
+    unsigned long mask;
+    int policy;
+    if (node == NUMA_ALL) {
+        mask = numa_node_count() == MAX_NODES 
+             ? ~0ul : (1ul << numa_node_count()) - 1;
+        policy = MPOL_INTERLEAVE;
+    } else {
+        mask = 1ul << node;
+        policy = MPOL_BIND;
+    }
+
+    //The kernel reads one less than maxnode bits
+    return syscall(SYS_mbind, addr, len, policy, &mask, MAX_NODES + 1, 0) == 0;
+}
+
+bool numa_pin_thread(u32 node) {
+    std::vector<u32> cpus = read_list(NODE_DIR + "node" + 
+                                      std::to_string(node) + "/cpulist");
+    if (cpus.empty()) return false;
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (u32 c : cpus) CPU_SET(c, &set);
+    return sched_setaffinity(0, sizeof(set), &set) == 0;
+}
+
+bool numa_thread_nodes(u16 threads, const std::string &nodes, 
+                       std::vector<u32> &thread_nodes) {
+    u32 node_count = numa_node_count();
+    thread_nodes.clear();
+
+    if (nodes.empty()) {
+        for (u32 t = 0; t < threads; t++) {
+            thread_nodes.push_back(t * node_count / threads);
+        }
+        return true;
+    }
+
+    std::istringstream ss(nodes);
+    std::string node;
+    std::vector<u32> list;
+    while (std::getline(ss, node, ',')) {
+        char *end;
+        long n = strtol(node.c_str(), &end, 10);
+        if (node.empty() || *end != '\0' || n < 0 || n >= node_count) {
+            std::cerr << "Error: invalid NUMA node \"" << node 
+                      << "\", expected 0-" << (node_count-1) << "\n";
+            return false;
+        }
+        list.push_back(n);
+    }
+
+    for (u32 t = 0; t < threads; t++) {
+        thread_nodes.push_back(list[t % list.size()]);
+    }
+    return true;
+}
@@ -0,0 +1,61 @@
+/* MIT License
+ *
+ * Copyright (c) 2018 Sam Kovaka <skovaka@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#ifndef INCL_NUMA
+#define INCL_NUMA
+
+#include <string>
+#include <vector>
+#include "util.hpp"
+
+//Placement of the index on multi-socket hosts. NUMA_INTERLEAVE spreads
+//one copy over all nodes, NUMA_REPLICATE keeps a copy on each node used 
+//by a mapper thread, and NUMA_AUTO leaves the index in place. Mapper 
+//threads are pinned to their node unless NUMA_OFF, and NUMA_AUTO is 
+//NUMA_OFF on a single node
+enum NumaMode {NUMA_OFF, NUMA_AUTO, NUMA_INTERLEAVE, NUMA_REPLICATE};
+
+//Node arguments meaning no placement, or interleaved over all nodes
+const i32 NUMA_ANY = -1, 
+          NUMA_ALL = -2;
+
+const char *numa_mode_name(NumaMode mode);
+
+//Number of memory nodes, 1 if NUMA isn't supported
+u32 numa_node_count();
+
+//Sets the memory policy of a mapping before it's first touched so its
+//pages are allocated on node, or interleaved if node is NUMA_ALL
+bool numa_bind(void *addr, u64 len, i32 node);
+
+//Restricts the calling thread to the CPUs of node
+bool numa_pin_thread(u32 node);
+
+//Assigns a node to each thread. nodes is a comma-separated list, 
+//repeated if shorter than the number of threads. If empty, threads are
+//split into equal contiguous blocks across all nodes
+bool numa_thread_nodes(u16 threads, const std::string &nodes, 
+                       std::vector<u32> &thread_nodes);
+
+#endif
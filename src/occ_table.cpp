@@ -0,0 +1,215 @@
+/* MIT License
+ *
+ * Copyright (c) 2018 Sam Kovaka <skovaka@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include "occ_table.hpp"
+
+//Sets bits corrasponding to base c in a 64-base word
+inline u64 match_bits(u64 lo, u64 hi, u8 c) {
+    return ((c & 1) ? lo : ~lo) & ((c & 2) ? hi : ~hi);
+}
+
+OccTable::OccTable() 
+    : blocks_(NULL),
+      n_blocks_(0),
+      len_(0),
+      primary_(0),
+      owned_(false) {}
+
+bool OccTable::alloc(u64 len, u64 primary, HugePageMode mode) {
+    len_ = len;
+    primary_ = primary;
+
+    //Always allocate a trailing block so rank(len_) is valid
+    n_blocks_ = len_ / BLOCK_LEN + 1;
+
+    blocks_ = (Block *) huge_alloc(n_blocks_ * sizeof(Block), mode);
+    if (blocks_ == NULL) {
+        std::cerr << "Error: failed to allocate occurrence table\n";
+        n_blocks_ = 0;
+        return false;
+    }
+    owned_ = true;
+    std::memset(blocks_, 0, n_blocks_ * sizeof(Block));
+    return true;
+}
+
+bool OccTable::init(const bwt_t *bwt, HugePageMode mode) {
+    if (!alloc(bwt->seq_len, bwt->primary, mode)) return false;
+
+    u64 counts[ALPH_SIZE] = {0, 0, 0, 0};
+
+    for (u64 b = 0; b < n_blocks_; b++) {
+        Block &blk = blocks_[b];
+        std::memcpy(blk.counts, counts, sizeof(counts));
+
+        u64 st = b * BLOCK_LEN, 
+            en = st + BLOCK_LEN < len_ ? st + BLOCK_LEN : len_;
+
+        for (u64 i = st; i < en; i++) {
+            u8 c = bwt_B0(bwt, i);
+            u64 w = (i - st) >> 6, bit = 1ull << ((i - st) & 63);
+            if (c & 1) blk.lo_bits[w] |= bit;
+            if (c & 2) blk.hi_bits[w] |= bit;
+            counts[c]++;
+        }
+    }
+    return true;
+}
+
+bool OccTable::init_packed(const u8 *rows, u64 len, u64 primary, 
+                           HugePageMode mode) {
+    if (!alloc(len, primary, mode)) return false;
+
+    u64 counts[ALPH_SIZE] = {0, 0, 0, 0};
+
+    for (u64 b = 0; b < n_blocks_; b++) {
+        Block &blk = blocks_[b];
+        std::memcpy(blk.counts, counts, sizeof(counts));
+
+        u64 st = b * BLOCK_LEN, 
+            en = st + BLOCK_LEN < len_ ? st + BLOCK_LEN : len_;
+
+        for (u64 i = st; i < en; i++) {
+            u64 r = i + (i >= primary_);
+            u8 c = (rows[r >> 2] >> ((~r & 3) << 1)) & 3;
+            u64 w = (i - st) >> 6, bit = 1ull << ((i - st) & 63);
+            if (c & 1) blk.lo_bits[w] |= bit;
+            if (c & 2) blk.hi_bits[w] |= bit;
+            counts[c]++;
+        }
+    }
+    return true;
+}
+
+void OccTable::init(const void *data, u64 len, u64 primary) {
+    len_ = len;
+    primary_ = primary;
+    n_blocks_ = len_ / BLOCK_LEN + 1;
+    blocks_ = (Block *) data;
+    owned_ = false;
+}
+
+void OccTable::destroy() {
+    if (blocks_ != NULL && owned_) {
+        huge_free(blocks_);
+    }
+    blocks_ = NULL;
+}
+
+bool OccTable::copy(OccTable &dst, HugePageMode mode, i32 node, 
+                    HugePageMode *used) const {
+    Block *blocks = (Block *) huge_alloc(byte_size(), mode, used, node);
+    if (blocks == NULL) {
+        std::cerr << "Error: failed to allocate occurrence table\n";
+        return false;
+    }
+
+    std::memcpy(blocks, blocks_, byte_size());
+    dst = *this;
+    dst.blocks_ = blocks;
+    dst.owned_ = true;
+
+    return true;
+}
+
+HugePageMode OccTable::move_to(HugePageMode mode, i32 node) {
+    OccTable table;
+    HugePageMode used = HUGE_NONE;
+    if (copy(table, mode, node, &used)) {
+        destroy();
+        *this = table;
+    }
+    return used;
+}
+
+const void *OccTable::data() const {
+    return blocks_;
+}
+
+u64 OccTable::byte_size() const {
+    return n_blocks_ * sizeof(Block);
+}
+
+u64 OccTable::byte_size(u64 len) {
+    return (len / BLOCK_LEN + 1) * sizeof(Block);
+}
+
+//Number of occurrences of c in the first i bases
+u64 OccTable::rank(u64 i, u8 c) const {
+    const Block &blk = blocks_[i / BLOCK_LEN];
+    u64 r = i % BLOCK_LEN,
+        m0 = match_bits(blk.lo_bits[0], blk.hi_bits[0], c),
+        m1 = match_bits(blk.lo_bits[1], blk.hi_bits[1], c);
+
+    if (r < 64) {
+        return blk.counts[c] + __builtin_popcountll(m0 & ((1ull << r) - 1));
+    }
+
+    return blk.counts[c] + __builtin_popcountll(m0) 
+                         + __builtin_popcountll(m1 & ((1ull << (r - 64)) - 1));
+}
+
+//Occurrences of each base in the first i bases
+void OccTable::rank4(u64 i, u64 cnt[ALPH_SIZE]) const {
+    const Block &blk = blocks_[i / BLOCK_LEN];
+    u64 r = i % BLOCK_LEN,
+        mask0 = r < 64 ? (1ull << r) - 1 : ~0ull,
+        mask1 = r < 64 ? 0 : (1ull << (r - 64)) - 1,
+        lo0 = blk.lo_bits[0], hi0 = blk.hi_bits[0],
+        lo1 = blk.lo_bits[1], hi1 = blk.hi_bits[1];
+
+    for (u8 c = 0; c < ALPH_SIZE; c++) {
+        cnt[c] = blk.counts[c] 
+               + __builtin_popcountll(match_bits(lo0, hi0, c) & mask0)
+               + __builtin_popcountll(match_bits(lo1, hi1, c) & mask1);
+    }
+}
+
+u64 OccTable::occ(u64 k, u8 c) const {
+    if (k == (u64) -1) return 0;
+
+    //'$' is not stored, so rows after the primary shift down one
+    return rank(k + (k < primary_), c);
+}
+
+void OccTable::occ4(u64 k, u64 cnt[ALPH_SIZE]) const {
+    if (k == (u64) -1) {
+        for (u8 c = 0; c < ALPH_SIZE; c++) cnt[c] = 0;
+        return;
+    }
+    rank4(k + (k < primary_), cnt);
+}
+
+u8 OccTable::get_base(u64 k) const {
+    k -= (k > primary_);
+    const Block &blk = blocks_[k / BLOCK_LEN];
+    u64 w = (k % BLOCK_LEN) >> 6, s = k & 63;
+    return (u8) (((blk.lo_bits[w] >> s) & 1) | (((blk.hi_bits[w] >> s) & 1) << 1));
+}
+
+u64 OccTable::size() const {
+    return len_;
+}
@@ -0,0 +1,104 @@
+/* MIT License
+ *
+ * Copyright (c) 2018 Sam Kovaka <skovaka@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef INCL_OCC_TABLE
+#define INCL_OCC_TABLE
+
+#include "util.hpp"
+#include "huge_pages.hpp"
+#include "bwa/bwt.h"
+
+//Occurrence table storing the BWT (without '$') in 64-byte blocks of 128 
+//bases. Each block holds the occurrence counts preceding the block and the
+//block's bases split into low and high bit planes, so any rank query touches
+//a single cache line
+class OccTable {
+    public:
+
+    static const u64 BLOCK_LEN = 128;
+
+    OccTable();
+
+    //Builds the table from a loaded bwa BWT
+    bool init(const bwt_t *bwt, HugePageMode mode = HUGE_NONE);
+
+    //Builds the table from the BWT of every suffix array row, packed 2 bits
+    //per base as in bwa's .pac. The primary row's base is skipped
+    bool init_packed(const u8 *rows, u64 len, u64 primary, 
+                     HugePageMode mode = HUGE_NONE);
+
+    //Uses a table previously stored from data(), without copying it.
+    //The memory must be 64-byte aligned and outlive the table
+    void init(const void *data, u64 len, u64 primary);
+
+    void destroy();
+
+    //Copies the table into new memory with the given page size and NUMA
+    //node. Sets used to the page size actually used
+    bool copy(OccTable &dst, HugePageMode mode, i32 node, 
+              HugePageMode *used = NULL) const;
+
+    //Replaces the table with a copy. Returns the page size actually used
+    HugePageMode move_to(HugePageMode mode, i32 node = NUMA_ANY);
+
+    const void *data() const;
+    u64 byte_size() const;
+
+    //Size of the table of a BWT with len bases
+    static u64 byte_size(u64 len);
+
+    //Number of occurrences of base c in BWT rows [0,k] (bwa's bwt_occ)
+    u64 occ(u64 k, u8 c) const;
+
+    //Occurrences of all four bases in BWT rows [0,k] (bwa's bwt_occ4)
+    void occ4(u64 k, u64 cnt[ALPH_SIZE]) const;
+
+    //Hints that occ(k, ...) will be called soon
+    inline void prefetch(u64 k) const {
+        if (k == (u64) -1) return;
+        __builtin_prefetch(&blocks_[(k + (k < primary_)) / BLOCK_LEN]);
+    }
+
+    //Base at BWT row k, which must not be the primary ('$') row
+    u8 get_base(u64 k) const;
+
+    u64 size() const;
+
+    private:
+
+    struct alignas(64) Block {
+        u64 counts[ALPH_SIZE];
+        u64 lo_bits[2], hi_bits[2];
+    };
+
+    bool alloc(u64 len, u64 primary, HugePageMode mode);
+
+    u64 rank(u64 i, u8 c) const;
+    void rank4(u64 i, u64 cnt[ALPH_SIZE]) const;
+
+    Block *blocks_;
+    u64 n_blocks_, len_, primary_;
+    bool owned_;
+};
+
+#endif
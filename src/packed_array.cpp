@@ -0,0 +1,140 @@
+/* MIT License
+ *
+ * Copyright (c) 2018 Sam Kovaka <skovaka@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include "packed_array.hpp"
+
+PackedArray::PackedArray() 
+    : words_(NULL),
+      len_(0),
+      mask_(0),
+      width_(0),
+      owned_(false) {}
+
+bool PackedArray::init(u64 len, u8 width, HugePageMode mode) {
+    len_ = len;
+    width_ = width;
+    mask_ = width_ == 64 ? ~0ull : (1ull << width_) - 1;
+
+    words_ = (u64 *) huge_alloc(byte_size(len_, width_), mode);
+    if (words_ == NULL) {
+        std::cerr << "Error: failed to allocate packed array\n";
+        return false;
+    }
+    owned_ = true;
+
+    return true;
+}
+
+void PackedArray::init(const void *data, u64 len, u8 width) {
+    len_ = len;
+    width_ = width;
+    mask_ = width_ == 64 ? ~0ull : (1ull << width_) - 1;
+    words_ = (u64 *) data;
+    owned_ = false;
+}
+
+void PackedArray::destroy() {
+    if (words_ != NULL && owned_) {
+        huge_free(words_);
+    }
+    words_ = NULL;
+}
+
+bool PackedArray::copy(PackedArray &dst, HugePageMode mode, i32 node, 
+                       HugePageMode *used) const {
+    u64 *words = (u64 *) huge_alloc(byte_size(), mode, used, node);
+    if (words == NULL) {
+        std::cerr << "Error: failed to allocate packed array\n";
+        return false;
+    }
+
+    std::memcpy(words, words_, byte_size());
+    dst = *this;
+    dst.words_ = words;
+    dst.owned_ = true;
+
+    return true;
+}
+
+HugePageMode PackedArray::move_to(HugePageMode mode, i32 node) {
+    PackedArray array;
+    HugePageMode used = HUGE_NONE;
+    if (copy(array, mode, node, &used)) {
+        destroy();
+        *this = array;
+    }
+    return used;
+}
+
+void PackedArray::set(u64 i, u64 val) {
+    u64 bit = i * width_, 
+        w = bit >> 6, 
+        off = bit & 63;
+
+    val &= mask_;
+    words_[w] = (words_[w] & ~(mask_ << off)) | (val << off);
+    if (off + width_ > 64) {
+        u64 shift = 64 - off;
+        words_[w+1] = (words_[w+1] & ~(mask_ >> shift)) | (val >> shift);
+    }
+}
+
+//Entries start zeroed, so their bits can be ORed in atomically
+void PackedArray::set_once(u64 i, u64 val) {
+    u64 bit = i * width_, 
+        w = bit >> 6, 
+        off = bit & 63;
+
+    val &= mask_;
+    __atomic_fetch_or(&words_[w], val << off, __ATOMIC_RELAXED);
+    if (off + width_ > 64) {
+        __atomic_fetch_or(&words_[w+1], val >> (64 - off), __ATOMIC_RELAXED);
+    }
+}
+
+u64 PackedArray::size() const {
+    return len_;
+}
+
+u8 PackedArray::width() const {
+    return width_;
+}
+
+const void *PackedArray::data() const {
+    return words_;
+}
+
+u64 PackedArray::byte_size() const {
+    return byte_size(len_, width_);
+}
+
+u64 PackedArray::byte_size(u64 len, u8 width) {
+    return ((len * width + 63) / 64 + 1) * sizeof(u64);
+}
+
+u8 PackedArray::bits_needed(u64 max_val) {
+    return max_val == 0 ? 1 : 64 - __builtin_clzll(max_val);
+}
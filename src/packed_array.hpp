@@ -0,0 +1,87 @@
+/* MIT License
+ *
+ * Copyright (c) 2018 Sam Kovaka <skovaka@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef INCL_PACKED_ARRAY
+#define INCL_PACKED_ARRAY
+
+#include "util.hpp"
+#include "huge_pages.hpp"
+
+//Fixed-width integer array packed into 64-bit words. Stores one extra
+//word so that any entry can be decoded from two word loads without 
+//branching
+class PackedArray {
+    public:
+
+    PackedArray();
+
+    //Allocates a zeroed array of len entries, width bits each
+    bool init(u64 len, u8 width, HugePageMode mode = HUGE_NONE);
+
+    //Uses an array previously stored from data(), without copying it.
+    //The memory must be 8-byte aligned and outlive the array
+    void init(const void *data, u64 len, u8 width);
+
+    void destroy();
+
+    //Copies the array into new memory with the given page size and NUMA
+    //node. Sets used to the page size actually used
+    bool copy(PackedArray &dst, HugePageMode mode, i32 node, 
+              HugePageMode *used = NULL) const;
+
+    //Replaces the array with a copy. Returns the page size actually used
+    HugePageMode move_to(HugePageMode mode, i32 node = NUMA_ANY);
+
+    void set(u64 i, u64 val);
+
+    //Same as set, but safe to call from multiple threads as long as each
+    //entry is only set once after init
+    void set_once(u64 i, u64 val);
+
+    inline u64 get(u64 i) const {
+        u64 bit = i * width_, 
+            w = bit >> 6, 
+            off = bit & 63;
+        return ((words_[w] >> off) | ((words_[w+1] << 1) << (63 - off))) & mask_;
+    }
+
+    u64 size() const;
+    u8 width() const;
+
+    const void *data() const;
+    u64 byte_size() const;
+
+    //Size in bytes of an array with len entries of width bits
+    static u64 byte_size(u64 len, u8 width);
+
+    //Number of bits needed to store values up to max_val
+    static u8 bits_needed(u64 max_val);
+
+    private:
+    u64 *words_;
+    u64 len_, mask_;
+    u8 width_;
+    bool owned_;
+};
+
+#endif
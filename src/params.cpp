@@ -29,7 +29,7 @@ Params PARAMS;
 Params::Params() : mode(Mode::UNINIT){}
 
 //Map constructor
-void Params::init_map(
+bool Params::init_map(
         const std::string &_bwa_prefix,
         const std::string &_model_fname,
         const std::string &_param_preset,
@@ -42,6 +42,11 @@ void Params::init_map(
         u32 _max_events_proc,
         u32 _evt_winlen1,
         u32 _evt_winlen2,
+        u32 _sa_intv,
+        u32 _sa_cache_mb,
+        u32 _huge_pages,
+        u32 _numa,
+        const std::string &_numa_nodes,
         u16 _threads,
         u16 _num_channels,
         float _evt_thresh1,
@@ -52,16 +57,18 @@ void Params::init_map(
         float _max_stay_frac,
         float _min_seed_prob, 
         float _min_mean_conf,
-        float _min_top_conf) {
+        float _min_top_conf,
+        float _prob_table_res) {
     PARAMS = 
         Params(Mode::MAP,_bwa_prefix,_model_fname,_param_preset,_seed_len,_min_aln_len,_min_rep_len,
          _max_rep_copy,_max_consec_stay,_max_paths,_max_events_proc,0,0,_evt_winlen1,
-         _evt_winlen2,_threads,_num_channels,0,0,0,_evt_thresh1,_evt_thresh2,
+         _evt_winlen2,_sa_intv,_sa_cache_mb,_huge_pages,_numa,_numa_nodes,_threads,_num_channels,0,0,0,_evt_thresh1,_evt_thresh2,
          _evt_peak_height,_evt_min_mean,_evt_max_mean,_max_stay_frac,_min_seed_prob,
-         _min_mean_conf,_min_top_conf,0,0,0,0,0,true,true);
+         _min_mean_conf,_min_top_conf,_prob_table_res,0,0,0,0,0,true,true);
+    return PARAMS.model.is_loaded() && INDEX_REGISTRY.load(_bwa_prefix);
 }
 
-void Params::init_realtime (
+bool Params::init_realtime (
         const std::string &_bwa_prefix,
         const std::string &_model_fname,
         const std::string &_param_preset,
@@ -76,6 +83,11 @@ void Params::init_realtime (
         u32 _evt_buffer_len,
         u32 _evt_winlen1,
         u32 _evt_winlen2,
+        u32 _sa_intv,
+        u32 _sa_cache_mb,
+        u32 _huge_pages,
+        u32 _numa,
+        const std::string &_numa_nodes,
         u16 _threads,
         u16 _num_channels,
         u16 _chunk_len,
@@ -90,6 +102,7 @@ void Params::init_realtime (
         float _min_seed_prob, 
         float _min_mean_conf,
         float _min_top_conf,
+        float _prob_table_res,
         float _max_chunk_wait,
         float _digitisation,
         std::vector<float> _offsets, 
@@ -98,16 +111,17 @@ void Params::init_realtime (
     PARAMS =
        Params(Mode::REALTIME,_bwa_prefix,_model_fname,_param_preset,_seed_len,_min_aln_len,
        _min_rep_len,_max_rep_copy,_max_consec_stay,_max_paths,_max_events_proc,
-       _max_chunks_proc,_evt_buffer_len,_evt_winlen1,_evt_winlen2,_threads,
+       _max_chunks_proc,_evt_buffer_len,_evt_winlen1,_evt_winlen2,_sa_intv,_sa_cache_mb,_huge_pages,_numa,_numa_nodes,_threads,
        _num_channels,_chunk_len,_evt_batch_size,_evt_timeout,_evt_thresh1,
        _evt_thresh2,_evt_peak_height,_evt_min_mean,_evt_max_mean,_max_stay_frac,
-       _min_seed_prob,_min_mean_conf,_min_top_conf,_max_chunk_wait,0,0,0,0,true,true);
+       _min_seed_prob,_min_mean_conf,_min_top_conf,_prob_table_res,_max_chunk_wait,0,0,0,0,true,true);
     PARAMS.set_calibration(_offsets, _ranges, _digitisation);
     PARAMS.set_sample_rate(_sample_rate);
+    return PARAMS.model.is_loaded() && INDEX_REGISTRY.load(_bwa_prefix);
 }
 
     //Simulate constructor
-void Params::init_sim(
+bool Params::init_sim(
         const std::string &_bwa_prefix,
         const std::string &_model_fname,
         const std::string &_param_preset,
@@ -122,6 +136,11 @@ void Params::init_sim(
         u32 _evt_buffer_len,
         u32 _evt_winlen1,
         u32 _evt_winlen2,
+        u32 _sa_intv,
+        u32 _sa_cache_mb,
+        u32 _huge_pages,
+        u32 _numa,
+        const std::string &_numa_nodes,
         u16 _threads,
         u16 _num_channels,
         u16 _chunk_len,
@@ -136,6 +155,7 @@ void Params::init_sim(
         float _min_seed_prob, 
         float _min_mean_conf,
         float _min_top_conf,
+        float _prob_table_res,
         float _max_chunk_wait,
         float _sim_speed,
         float _sim_st,
@@ -146,11 +166,12 @@ void Params::init_sim(
     PARAMS =
        Params(Mode::SIMULATE,_bwa_prefix,_model_fname,_param_preset,_seed_len,_min_aln_len,
        _min_rep_len,_max_rep_copy,_max_consec_stay,_max_paths,_max_events_proc,
-       _max_chunks_proc,_evt_buffer_len,_evt_winlen1,_evt_winlen2,_threads,
+       _max_chunks_proc,_evt_buffer_len,_evt_winlen1,_evt_winlen2,_sa_intv,_sa_cache_mb,_huge_pages,_numa,_numa_nodes,_threads,
        _num_channels,_chunk_len,_evt_batch_size,_evt_timeout,_evt_thresh1,
        _evt_thresh2,_evt_peak_height,_evt_min_mean,_evt_max_mean,_max_stay_frac,
-       _min_seed_prob,_min_mean_conf,_min_top_conf,_max_chunk_wait,
+       _min_seed_prob,_min_mean_conf,_min_top_conf,_prob_table_res,_max_chunk_wait,
        _sim_speed,_sim_st,_sim_en,_sim_gaps,_sim_even,_sim_odd);
+    return PARAMS.model.is_loaded() && INDEX_REGISTRY.load(_bwa_prefix);
 }
 
 Params::Params(Mode _mode,
@@ -168,6 +189,11 @@ Params::Params(Mode _mode,
                u32 _evt_buffer_len,
                u32 _evt_winlen1,
                u32 _evt_winlen2,
+               u32 _sa_intv,
+               u32 _sa_cache_mb,
+               u32 _huge_pages,
+               u32 _numa,
+               const std::string &_numa_nodes,
                u16 _threads,
                u16 _num_channels,
                u16 _chunk_len,
@@ -182,6 +208,7 @@ Params::Params(Mode _mode,
                float _min_seed_prob, 
                float _min_mean_conf,
                float _min_top_conf,
+               float _prob_table_res,
                float _max_chunk_wait,
                float _sim_speed,
                float _sim_st,
@@ -190,7 +217,8 @@ Params::Params(Mode _mode,
                bool  _sim_even,
                bool  _sim_odd) :
     mode               (_mode),
-    fmi                (_bwa_prefix),
+    param_preset       (_param_preset),
+    huge_pages         ((HugePageMode) _huge_pages),
     model              (_model_fname, true),
     event_params       ({_evt_winlen1,_evt_winlen2,
                          _evt_thresh1,_evt_thresh2,
@@ -205,6 +233,8 @@ Params::Params(Mode _mode,
     max_events_proc    (_max_events_proc),
     max_chunks_proc    (_max_chunks_proc),
     evt_buffer_len     (_evt_buffer_len),
+    sa_intv            (_sa_intv),
+    sa_cache_mb        (_sa_cache_mb),
     threads            (_threads),
     num_channels       (_num_channels),
     chunk_len          (_chunk_len),
@@ -214,6 +244,7 @@ Params::Params(Mode _mode,
     min_seed_prob      (_min_seed_prob),
     min_mean_conf      (_min_mean_conf),
     min_top_conf       (_min_top_conf),
+    prob_table_res     (_prob_table_res),
     max_chunk_wait     (_max_chunk_wait),
     sim_speed          (_sim_speed),
     sim_st             (_sim_st),
@@ -227,56 +258,30 @@ Params::Params(Mode _mode,
     calib_offsets      (_num_channels, 0), 
     calib_coefs        (_num_channels, 0){
 
-    //TODO: exception handling
-    std::ifstream param_file(_bwa_prefix + INDEX_SUFF);
-    std::string param_line;
-
-    char *param_preset = (char *) _param_preset.c_str();
-    prob_threshes.resize(64);
-
-    while (getline(param_file, param_line)) {
-        char *param_name = strtok((char *) param_line.c_str(), "\t");
-        char *fn_str = strtok(NULL, "\t");
-        //char *path_str = strtok(NULL, "\t");
-        if ( !_param_preset.empty() && strcmp(param_name, param_preset) ) {
-                continue;
-        }
-
-        u8 fmbin = prob_threshes.size() - 1;
-        char *prob_str;
-        while ( (prob_str = strtok(fn_str, ",")) != NULL ) {
-            fn_str = NULL;
-            prob_threshes[fmbin] = atof(prob_str);
-            fmbin--;
-        }
-
-        for (;fmbin < prob_threshes.size(); fmbin--) {
-            prob_threshes[fmbin] = prob_threshes[fmbin+1];
-        }
-
-        //while ( (prob_str = strtok(path_str, ",")) != NULL ) {
-        //    path_str = NULL;
-        //    path_threshes.push_back(atof(prob_str));
-        //}
+    //Replicating multiplies index memory, so only do it when asked
+    numa = (NumaMode) _numa;
+    if (numa == NUMA_AUTO && numa_node_count() <= 1) {
+        numa = NUMA_OFF;
+    }
+    if (numa != NUMA_OFF && !numa_thread_nodes(threads, _numa_nodes, thread_nodes)) {
+        numa = NUMA_OFF;
     }
 
-    u64 max_len = 0;
-    kmer_fmranges = std::vector<Range>(model.kmer_count());
-    for (u16 k = 0; k < model.kmer_count(); k++) {
-
-        Range r = fmi.get_full_range(model.get_first_base(k));
-        for (u8 i = 1; i < model.kmer_len(); i++) {
-            r = fmi.get_neighbor(r, model.get_base(k, i));
-        }
-
-        kmer_fmranges[k] = r;
-
-        if (r.length() > max_len) {
-            max_len = r.length();
+    if (prob_table_res > 0 && model.is_loaded() && 
+        model.init_prob_table(prob_table_res)) {
+        float err = model.prob_table_error();
+        if (err > PROB_TABLE_MAX_ERROR) {
+            std::cerr << "Warning: k-mer probability table error " << err
+                      << " is above " << PROB_TABLE_MAX_ERROR 
+                      << ", not using it. Use a finer --prob-table-res\n";
+            model.init_prob_table(0);
+        } else {
+            std::cerr << "K-mer probability table: " 
+                      << (model.prob_table_bytes() >> 20) << " MB, max error "
+                      << err << "\n";
         }
     }
 
-
     bp_per_samp = bp_per_sec / sample_rate;
     
     master_time.reset();
@@ -286,18 +291,15 @@ u32 Params::get_time() {
     return master_time.get();
 }
 
-float Params::get_prob_thresh(u64 fmlen) const {
-    return prob_threshes[__builtin_clzll(fmlen)];
+i32 Params::thread_node(u16 tid) const {
+    if (thread_nodes.empty()) return NUMA_ANY;
+    return thread_nodes[tid % thread_nodes.size()];
 }
 
 float Params::get_path_thresh(u32 pathlen) const {
     return path_threshes[min(pathlen, path_threshes.size())-1];
 }
 
-float Params::get_source_prob() const {
-    return prob_threshes.front();
-}
-
 bool Params::check_map_conf(u32 seed_len, float mean_len, float second_len) {
     return (min_mean_conf > 0 && seed_len / mean_len >= min_mean_conf) ||
            (min_top_conf > 0  && seed_len / second_len >= min_top_conf);
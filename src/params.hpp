@@ -26,12 +26,10 @@
 
 #include <iostream>
 #include <vector>
-#include "bwa_fmi.hpp"
+#include "ref_index.hpp"
 #include "kmer_model.hpp"
 #include "timer.hpp"
 
-#define INDEX_SUFF ".uncl"
-
 class Params {
     public:
     enum Mode {UNINIT, MAP, REALTIME, SIMULATE};
@@ -39,7 +37,7 @@ class Params {
     Params();
     
     //Map constructor
-    static void init_map (
+    static bool init_map (
         const std::string &_bwa_prefix,
         const std::string &_model_fname,
         const std::string &_param_preset,
@@ -52,6 +50,11 @@ class Params {
         u32 _max_events_proc,
         u32 _evt_winlen1,
         u32 _evt_winlen2,
+        u32 _sa_intv,
+        u32 _sa_cache_mb,
+        u32 _huge_pages,
+        u32 _numa,
+        const std::string &_numa_nodes,
         u16 _threads,
         u16 _num_channels,
         float _evt_thresh1,
@@ -62,10 +65,11 @@ class Params {
         float _max_stay_frac,
         float _min_seed_prob, 
         float _min_mean_conf,
-        float _min_top_conf);
+        float _min_top_conf,
+        float _prob_table_res);
     
     //Realtime constructor
-    static void init_realtime (
+    static bool init_realtime (
         const std::string &_bwa_prefix,
         const std::string &_model_fname,
         const std::string &_param_preset,
@@ -80,6 +84,11 @@ class Params {
         u32 _evt_buffer_len,
         u32 _evt_winlen1,
         u32 _evt_winlen2,
+        u32 _sa_intv,
+        u32 _sa_cache_mb,
+        u32 _huge_pages,
+        u32 _numa,
+        const std::string &_numa_nodes,
         u16 _threads,
         u16 _num_channels,
         u16 _chunk_len,
@@ -94,6 +103,7 @@ class Params {
         float _min_seed_prob, 
         float _min_mean_conf,
         float _min_top_conf,
+        float _prob_table_res,
         float _max_chunk_wait,
         float _digitisation,
         std::vector<float> _offsets, 
@@ -101,7 +111,7 @@ class Params {
         float sample_rate=4000);
 
     //Simulate constructor
-    static void init_sim (
+    static bool init_sim (
         const std::string &_bwa_prefix,
         const std::string &_model_fname,
         const std::string &_param_preset,
@@ -116,6 +126,11 @@ class Params {
         u32 _evt_buffer_len,
         u32 _evt_winlen1,
         u32 _evt_winlen2,
+        u32 _sa_intv,
+        u32 _sa_cache_mb,
+        u32 _huge_pages,
+        u32 _numa,
+        const std::string &_numa_nodes,
         u16 _threads,
         u16 _num_channels,
         u16 _chunk_len,
@@ -130,6 +145,7 @@ class Params {
         float _min_seed_prob, 
         float _min_mean_conf,
         float _min_top_conf,
+        float _prob_table_res,
         float _max_chunk_wait,
         float _sim_speed,
         float _sim_st,
@@ -139,9 +155,7 @@ class Params {
         bool  _sim_odd);
 
     u16 get_max_events(u16 event_i) const;
-    float get_prob_thresh(u64 fm_length) const;
     float get_path_thresh(u32 path_length) const;
-    float get_source_prob() const;
     bool check_map_conf(u32 seed_len, float mean_len, float second_len);
     
     void set_sample_rate(float rate);
@@ -162,9 +176,14 @@ class Params {
 
     u32 get_time();
 
+    //Node a mapper thread is pinned to, NUMA_ANY if not pinned
+    i32 thread_node(u16 tid) const;
+
     Mode mode;
 
-    BwaFMI fmi;
+    std::string param_preset;
+    HugePageMode huge_pages;
+    NumaMode numa;
     KmerModel model;
     EventParams event_params;
 
@@ -176,7 +195,9 @@ class Params {
         max_consec_stay,
         max_events_proc,
         max_chunks_proc,
-        evt_buffer_len;
+        evt_buffer_len,
+        sa_intv,
+        sa_cache_mb;
 
     u16 threads,
         num_channels,
@@ -188,6 +209,7 @@ class Params {
           min_seed_prob,
           min_mean_conf,
           min_top_conf,
+          prob_table_res,
           max_chunk_wait,
           bp_per_samp,
           sim_speed,
@@ -197,9 +219,8 @@ class Params {
     
     bool sim_even, sim_odd;
 
-    std::vector<float> prob_threshes;
     std::vector<float> path_threshes;
-    std::vector<Range> kmer_fmranges;
+    std::vector<u32> thread_nodes;
 
     float sample_rate, bp_per_sec;
     float calib_digitisation;
@@ -222,6 +243,11 @@ class Params {
            u32 _evt_buffer_len,
            u32 _evt_winlen1,
            u32 _evt_winlen2,
+           u32 _sa_intv,
+           u32 _sa_cache_mb,
+           u32 _huge_pages,
+           u32 _numa,
+           const std::string &_numa_nodes,
            u16 _threads,
            u16 _num_channels,
            u16 _chunk_len,
@@ -236,6 +262,7 @@ class Params {
            float _min_seed_prob, 
            float _min_mean_conf,
            float _min_top_conf,
+           float _prob_table_res,
            float _max_chunk_wait,
            float _sim_speed,
            float _sim_st,
@@ -31,40 +31,106 @@ u64 max(u64 a, u64 b);
 
 u64 min(u64 a, u64 b);
 
-class Range {
+//Range of BWT rows or reference coordinates, templated on the coordinate 
+//type so references under 4 Gbp can use 32-bit ranges
+template <typename T>
+class BasicRange {
     
     public:
-    u64 start_, end_; 
+    T start_, end_; 
 
     //Copy constructor
-    Range(const Range &prev);
-
-    Range(u64 start, u64 end);
-
-    Range();
-
-    Range& operator=(const Range &r);
-
-    Range split_range(const Range &r);
-
-    Range intersect(const Range &r) const;
-
-    Range merge(const Range &r) const;
-
-    float get_recp_overlap(const Range &r) const;
-
-    bool same_range(const Range &r) const;
-
-    bool intersects(const Range &r) const;
-
-    bool is_valid() const;
-
-    u64 length() const;
-
-    friend bool operator< (const Range &q1, const Range &q2);
+    BasicRange(const BasicRange &prev) 
+        : start_(prev.start_), 
+          end_(prev.end_) {}
+
+    //Converts between coordinate widths
+    template <typename U>
+    explicit BasicRange(const BasicRange<U> &prev)
+        : start_(prev.start_), 
+          end_(prev.end_) {}
+
+    BasicRange(T start, T end) : start_(start), end_(end) {}
+
+    BasicRange() : start_(1), end_(0) {}
+
+    BasicRange& operator=(const BasicRange &r) {
+        start_ = r.start_;
+        end_ = r.end_;
+        return *this;
+    }
+
+    BasicRange split_range(const BasicRange &r) {
+        BasicRange left;
+        if (start_ < r.start_) {
+            left = BasicRange(*this);
+            left.end_ = r.start_ - 1;
+        }
+
+        if (start_ <= r.end_) {
+            if (end_ > r.end_) {
+                start_ = r.end_ + 1;
+            } else {
+                start_ = 1;
+                end_ = 0;
+            }
+        }
+
+        return left;
+    }
+
+    BasicRange intersect(const BasicRange &r) const {
+        if (!intersects(r)) {
+            return BasicRange();
+        }
+        return BasicRange(start_ > r.start_ ? start_ : r.start_, 
+                          end_ < r.end_ ? end_ : r.end_);
+    }
+
+    BasicRange merge(const BasicRange &r) const {
+        if (!intersects(r)) {
+            return BasicRange();
+        }
+        return BasicRange(start_ < r.start_ ? start_ : r.start_, 
+                          end_ > r.end_ ? end_ : r.end_);
+    }
+
+    float get_recp_overlap(const BasicRange &r) const {
+        if (!intersects(r)) {
+            return 0;
+        }
+        return float(intersect(r).length()) / float(merge(r).length());
+    }
+
+    bool same_range(const BasicRange &q) const {
+        return start_ == q.start_ && end_ == q.end_;
+    }
+
+    bool intersects(const BasicRange &q) const {
+        return is_valid() && q.is_valid() &&
+               !(start_ > q.end_ || end_ < q.start_) &&
+               !(q.start_ > end_ || q.end_ < start_);
+    }
+
+    bool is_valid() const {
+        return start_ <= end_;
+    }
+
+    T length() const {
+        return end_ - start_ + 1;
+    }
+
+    friend bool operator< (const BasicRange &q1, const BasicRange &q2) {
+        return q1.start_ < q2.start_ ||
+               (q1.start_ == q2.start_ && q1.end_ < q2.end_);
+    }
+
+    friend bool operator== (const BasicRange &q1, const BasicRange &q2) {
+        return q1.start_ == q2.start_ && q1.end_ == q2.end_;
+    }
 };
 
-bool operator< (const Range &q1, const Range &q2);
-bool operator== (const Range &q1, const Range &q2);
+typedef BasicRange<u64> Range;
+typedef BasicRange<u32> Range32;
 
 #endif
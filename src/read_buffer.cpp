@@ -42,13 +42,12 @@ Paf::Paf()
     : is_mapped_(false),
       ended_(false),
       rd_name_(""),
-      rf_name_(""),
+      rf_id_(-1),
       rd_st_(0),
       rd_en_(0),
       rd_len_(0),
       rf_st_(0),
       rf_en_(0),
-      rf_len_(0),
       fwd_(false),
       matches_(0) {}
 
@@ -56,13 +55,12 @@ Paf::Paf(const std::string &rd_name, u16 channel, u64 start_sample)
     : is_mapped_(false),
       ended_(false),
       rd_name_(rd_name),
-      rf_name_(""),
+      rf_id_(-1),
       rd_st_(0),
       rd_en_(0),
       rd_len_(0),
       rf_st_(0),
       rf_en_(0),
-      rf_len_(0),
       fwd_(false),
       matches_(0) {
     
@@ -85,9 +83,14 @@ void Paf::print_paf() const {
        std::cout 
            << rd_st_ << "\t"
            << rd_en_ << "\t"
-           << (fwd_ ? '+' : '-') << "\t"
-           << rf_name_ << "\t"
-           << rf_len_ << "\t"
+           << (fwd_ ? '+' : '-') << "\t";
+       if (rf_names_ && rf_id_ >= 0) {
+           std::cout << rf_names_->get_name(rf_id_) << "\t"
+                     << rf_names_->get_len(rf_id_) << "\t";
+       } else {
+           std::cout << "*\t0\t";
+       }
+       std::cout
            << rf_st_ << "\t"
            << rf_en_ << "\t"
            << matches_ << "\t"
@@ -128,17 +131,18 @@ void Paf::set_ended() {
     //set_int(Tag::ENDED, 1);
 }
 
+//Only stores the contig id, its name is looked up by print_paf
 void Paf::set_mapped(u64 rd_st, u64 rd_en,
-                          std::string rf_name,
-                          u64 rf_st, u64 rf_en, u64 rf_len,
+                          const RefNames::Ptr &rf_names, i32 rf_id,
+                          u64 rf_st, u64 rf_en,
                           bool fwd, u16 matches) {
     is_mapped_ = true;
     rd_st_ = rd_st;
     rd_en_ = rd_en;
-    rf_name_ = rf_name;
+    rf_names_ = rf_names;
+    rf_id_ = rf_id;
     rf_st_ = rf_st;
     rf_en_ = rf_en;
-    rf_len_ = rf_len;
     fwd_ = fwd;
     matches_ = matches;
 }
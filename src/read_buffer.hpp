@@ -30,6 +30,7 @@
 #include "fast5/hdf5_tools.hpp"
 #include "util.hpp"
 #include "chunk.hpp"
+#include "ref_names.hpp"
 
 class Paf {
     public:
@@ -53,8 +54,8 @@ class Paf {
     void print_paf() const;
     void set_read_len(u64 rd_len);
     void set_mapped(u64 rd_st, u64 rd_en, 
-                    std::string rf_name,
-                    u64 rf_st, u64 rf_en, u64 rf_len,
+                    const RefNames::Ptr &rf_names, i32 rf_id,
+                    u64 rf_st, u64 rf_en,
                     bool fwd, u16 matches);
     void set_ended();
     void set_unmapped();
@@ -67,9 +68,11 @@ class Paf {
     static const std::string PAF_TAGS[];
 
     bool is_mapped_, ended_;
-    std::string rd_name_, rf_name_;
+    std::string rd_name_;
+    RefNames::Ptr rf_names_;
+    i32 rf_id_;
     u64 rd_st_, rd_en_, rd_len_,
-        rf_st_, rf_en_, rf_len_;
+        rf_st_, rf_en_;
     bool fwd_;
     u16 matches_;
 
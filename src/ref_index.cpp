@@ -0,0 +1,596 @@
+/* MIT License
+ *
+ * Copyright (c) 2018 Sam Kovaka <skovaka@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include <iostream>
+#include <fstream>
+#include <cstring>
+#include <cstdio>
+#include <algorithm>
+#include "ref_index.hpp"
+#include "bwa_fmi.hpp"
+#include "fm_trace.hpp"
+#include "params.hpp"
+#include "timer.hpp"
+
+IndexRegistry INDEX_REGISTRY;
+
+//Set when the registry is destroyed at exit, after which indexes are 
+//freed on the releasing thread. Both are constant initialized, so they
+//can be used by indexes released after the registry is destroyed
+static std::atomic<bool> registry_closed(false);
+static std::mutex registry_mutex;
+
+//Nodes without a mapper thread have no replica
+static void free_replicas(std::vector<FMIndex *> &replicas) {
+    for (FMIndex *r : replicas) {
+        if (r == NULL) continue;
+        r->destroy();
+        delete r;
+    }
+    replicas.clear();
+}
+
+//One threshold per leading zero count of an FM range length
+static const u32 THRESH_BINS = 64;
+
+//Binary parameter file layout: header, presets, then the range of 
+//every k-mer in id order
+struct ParamHeader {
+    char magic[8];
+    u64 version,
+        checksum,
+        preset_count,
+        kmer_len,
+        reserved[3];
+};
+
+struct ParamPreset {
+    char name[48];
+    float prob, speed;
+    float threshes[THRESH_BINS];
+};
+
+static const char PARAM_MAGIC[8] = {'U','N','C','L','P','R','M','\0'};
+static const u64 PARAM_VERSION = 2;
+
+//Ranges of every k-mer, in the same order as the model's k-mer ids
+static std::vector<Range> get_kmer_ranges(const FMIndex &fmi, u8 kmer_len) {
+    std::vector<Range> ranges(1ull << (2 * kmer_len));
+    for (u64 k = 0; k < ranges.size(); k++) {
+        Range r = fmi.get_full_range((k >> (2 * kmer_len - 2)) & 0x3);
+        for (u8 i = 1; i < kmer_len; i++) {
+            r = fmi.get_neighbor(r, (k >> (2 * (kmer_len - i - 1))) & 0x3);
+        }
+        ranges[k] = r;
+    }
+    return ranges;
+}
+
+//Thresholds are listed from the smallest FM range, which falls in the 
+//last bin. Larger ranges than listed use the last threshold
+static void expand_threshes(const std::vector<float> &vals, float *bins) {
+    u32 n = std::min<u64>(vals.size(), THRESH_BINS);
+    for (u32 i = 0; i < THRESH_BINS; i++) {
+        u32 j = THRESH_BINS - 1 - i;
+        bins[j] = i < n ? vals[i] : (n > 0 ? bins[j+1] : 0);
+    }
+}
+
+IndexOptions::IndexOptions()
+    : kmer_len(0),
+      sa_intv(0),
+      sa_cache_mb(0),
+      huge_pages(HUGE_NONE),
+      numa(NUMA_OFF) {}
+
+IndexOptions::IndexOptions(const Params &p)
+    : param_preset(p.param_preset),
+      kmer_len(p.model.kmer_len()),
+      sa_intv(p.sa_intv),
+      sa_cache_mb(p.sa_cache_mb),
+      huge_pages(p.huge_pages),
+      numa(p.numa),
+      thread_nodes(p.thread_nodes) {}
+
+i32 IndexOptions::thread_node(u16 tid) const {
+    if (thread_nodes.empty()) return NUMA_ANY;
+    return thread_nodes[tid % thread_nodes.size()];
+}
+
+RefIndex::RefIndex() : fmi(NULL), added(NULL) {}
+
+bool RefIndex::load(const std::string &_prefix, const IndexOptions &_opts) {
+    prefix = _prefix;
+    opts = _opts;
+    fmi = load_fm_index(prefix);
+    if (fmi == NULL) {
+        std::cerr << "Error: failed to load index '" << prefix << "'\n";
+        return false;
+    }
+
+    //Records queries for fm_bench
+    #ifdef FM_TRACE
+    fmi = new FMTracer(fmi, prefix + TRACE_SUFF);
+    #endif
+
+    u64 sa_intv = fmi->get_sa_intv();
+    if (sa_intv > 0 && opts.sa_intv > 0 && opts.sa_intv != sa_intv) {
+        Timer t;
+        if (fmi->set_sa_intv(opts.sa_intv)) {
+            std::cerr << "Resampled suffix array in " 
+                      << (t.get() / 1000) << " sec\n";
+            sa_intv = opts.sa_intv;
+        }
+    }
+
+    //Each locate takes up to sa_intv-1 LF steps, 1 is a single lookup.
+    //Other layouts don't sample by row
+    std::cerr << "FM index uses " << (fmi->byte_size() >> 20) << " MB";
+    if (sa_intv > 0) {
+        std::cerr << ", suffix array interval " << sa_intv << ", up to "
+                  << (sa_intv - 1) << " LF steps per locate";
+    }
+    std::cerr << "\n";
+
+    //Replicas are copied from the loaded index below
+    i32 fmi_node = opts.numa == NUMA_INTERLEAVE ? NUMA_ALL : NUMA_ANY;
+    if ((opts.huge_pages != HUGE_NONE && opts.numa != NUMA_REPLICATE) || 
+        fmi_node != NUMA_ANY) {
+        HugePageMode used = fmi->move_to(opts.huge_pages, fmi_node);
+        std::cerr << "Index loaded on " << huge_page_name(used) << " pages\n";
+    }
+
+    if (opts.sa_cache_mb > 0 && sa_intv > 1) {
+        fmi->init_sa_cache(u64(opts.sa_cache_mb) << 20);
+    }
+
+    //The loaded index is moved to the first node rather than copied, so
+    //each node used holds one copy
+    if (opts.numa == NUMA_REPLICATE) {
+        fmi_replicas.resize(numa_node_count(), NULL);
+        std::vector<bool> copied(fmi_replicas.size(), false);
+        HugePageMode used = opts.huge_pages, node_used;
+        bool replicated = true, moved = false;
+
+        for (u32 node : opts.thread_nodes) {
+            if (copied[node]) continue;
+            if (!moved) {
+                node_used = fmi->move_to(opts.huge_pages, node);
+                moved = true;
+            } else {
+                fmi_replicas[node] = 
+                    fmi->replicate(opts.huge_pages, node, &node_used);
+                if (fmi_replicas[node] == NULL) {
+                    replicated = false;
+                    break;
+                }
+            }
+            if (node_used < used) used = node_used;
+            copied[node] = true;
+        }
+
+        if (!replicated) {
+            std::cerr << "Error: failed to replicate index, "
+                      << "all threads will share one copy\n";
+            free_replicas(fmi_replicas);
+        } else {
+            std::cerr << "Index replicated on NUMA nodes";
+            for (u32 node = 0; node < copied.size(); node++) {
+                if (copied[node]) std::cerr << " " << node;
+            }
+            std::cerr << " using " << huge_page_name(used) << " pages\n";
+        }
+    }
+
+    if (opts.numa == NUMA_INTERLEAVE) {
+        std::cerr << "Index interleaved across " 
+                  << numa_node_count() << " NUMA nodes\n";
+    }
+
+    if (!fmi->is_double_stranded()) {
+        std::cerr << "Warning: index only contains the forward strand, "
+                  << "reads from the forward strand will not be mapped\n";
+    }
+
+    load_tables();
+
+    if (!load_params(prefix + INDEX_SUFF)) return false;
+
+    if (std::ifstream(prefix + ADDED_SUFF + FMI_SUFF).good()) {
+        added = new RefIndex();
+        if (!added->load_added(prefix + ADDED_SUFF, *this)) return false;
+    }
+
+    return true;
+}
+
+bool RefIndex::load_added(const std::string &_prefix, const RefIndex &main) {
+    prefix = _prefix;
+    opts = main.opts;
+    fmi = load_fm_index(prefix);
+    if (fmi == NULL) {
+        std::cerr << "Error: failed to load added sequences '" 
+                  << prefix << "'\n";
+        return false;
+    }
+
+    load_tables();
+
+    //Uses the main index's thresholds unless "uncalled index" was run on 
+    //the added sequences since they were last changed
+    std::string params_fname = prefix + INDEX_SUFF;
+    bool own_params = std::ifstream(params_fname).good();
+    if (own_params && !load_params(params_fname)) {
+        std::cerr << "Using the main index's parameters for added "
+                  << "sequences\n";
+        own_params = false;
+    }
+
+    if (!own_params) {
+        prob_threshes = main.prob_threshes;
+        kmer_fmranges = get_kmer_ranges(*fmi, opts.kmer_len);
+    }
+
+    std::cerr << "Searching " << fmi->get_names()->size() 
+              << " added sequences alongside the index\n";
+    return true;
+}
+
+void RefIndex::load_tables() {
+    if (jump_table.load(prefix + JUMP_SUFF, *fmi, opts.kmer_len)) {
+        std::cerr << "Using jump table for sequences up to length "
+                  << (int) jump_table.max_len() << " in '" << prefix 
+                  << "'\n";
+    }
+
+    if (repeat_mask.load(prefix + REPEAT_SUFF, *fmi)) {
+        std::cerr << "Using repeat mask for repeats of at least "
+                  << repeat_mask.min_len() << " bases in '" << prefix 
+                  << "'\n";
+    }
+}
+
+bool RefIndex::load_params(const std::string &fname) {
+    std::ifstream in(fname, std::ios::binary);
+    char magic[sizeof(PARAM_MAGIC)] = {0};
+    if (!in.read(magic, sizeof(magic)) && in.gcount() == 0) {
+        std::cerr << "Error: failed to read '" << fname << "'\n";
+        return false;
+    }
+    in.close();
+
+    //Files written before the binary format are still read as text
+    bool ret;
+    if (std::memcmp(magic, PARAM_MAGIC, sizeof(PARAM_MAGIC)) == 0) {
+        ret = load_binary_params(fname);
+    } else {
+        ret = load_text_params(fname);
+    }
+    if (!ret) return false;
+
+    //Tables for another k-mer length can't be used with this model
+    if (kmer_fmranges.size() != (1ull << (2 * opts.kmer_len))) {
+        kmer_fmranges = get_kmer_ranges(*fmi, opts.kmer_len);
+    }
+
+    return true;
+}
+
+bool RefIndex::load_binary_params(const std::string &fname) {
+    std::ifstream in(fname, std::ios::binary | std::ios::ate);
+    u64 file_len = in.tellg();
+    in.seekg(0);
+
+    ParamHeader h;
+    in.read((char *) &h, sizeof(h));
+
+    if (!in.good() || h.version != PARAM_VERSION || 
+        h.kmer_len < MIN_KMER_LEN || h.kmer_len > MAX_KMER_LEN ||
+        sizeof(h) + h.preset_count * sizeof(ParamPreset) + 
+            (1ull << (2 * h.kmer_len)) * sizeof(Range) != file_len) {
+        std::cerr << "Error: '" << fname << "' is corrupt or from another "
+                  << "version, rerun 'uncalled index'\n";
+        return false;
+    }
+
+    if (h.checksum != index_checksum(*fmi)) {
+        std::cerr << "Error: '" << fname << "' was computed for a different "
+                  << "index, rerun 'uncalled index'\n";
+        return false;
+    }
+
+    //With no preset given the last one in the file is used
+    ParamPreset p, found;
+    bool has_preset = false;
+    for (u64 i = 0; i < h.preset_count; i++) {
+        in.read((char *) &p, sizeof(p));
+        p.name[sizeof(p.name) - 1] = '\0';
+        if (opts.param_preset.empty() || opts.param_preset == p.name) {
+            found = p;
+            has_preset = true;
+        }
+    }
+
+    if (!has_preset) {
+        std::cerr << "Error: preset '" << opts.param_preset 
+                  << "' not found in '" << fname << "'\n";
+        return false;
+    }
+
+    prob_threshes.assign(found.threshes, found.threshes + THRESH_BINS);
+
+    kmer_fmranges.resize(1ull << (2 * h.kmer_len));
+    in.read((char *) kmer_fmranges.data(), 
+            kmer_fmranges.size() * sizeof(Range));
+
+    if (!in.good()) {
+        std::cerr << "Error: failed to read '" << fname << "'\n";
+        return false;
+    }
+
+    return true;
+}
+
+bool RefIndex::load_text_params(const std::string &fname) {
+    std::ifstream param_file(fname);
+    std::string param_line;
+    bool has_preset = false;
+
+    prob_threshes.resize(THRESH_BINS);
+
+    //Each line is a preset name and its comma separated thresholds
+    while (getline(param_file, param_line)) {
+        char *param_name = strtok((char *) param_line.c_str(), "\t");
+        char *fn_str = strtok(NULL, "\t");
+        if (param_name == NULL || fn_str == NULL ||
+            (!opts.param_preset.empty() && opts.param_preset != param_name)) {
+            continue;
+        }
+
+        std::vector<float> vals;
+        char *prob_str;
+        while ( (prob_str = strtok(fn_str, ",")) != NULL ) {
+            fn_str = NULL;
+            vals.push_back(atof(prob_str));
+        }
+        expand_threshes(vals, prob_threshes.data());
+        has_preset = true;
+    }
+
+    if (!has_preset) {
+        std::cerr << "Error: preset '" << opts.param_preset 
+                  << "' not found in '" << fname << "'\n";
+        return false;
+    }
+
+    kmer_fmranges.clear();
+    return true;
+}
+
+void RefIndex::destroy() {
+    if (added != NULL) {
+        added->destroy();
+        delete added;
+        added = NULL;
+    }
+    free_replicas(fmi_replicas);
+    jump_table.destroy();
+    repeat_mask.destroy();
+    if (fmi != NULL) {
+        fmi->destroy();
+        delete fmi;
+        fmi = NULL;
+    }
+}
+
+const FMIndex &RefIndex::thread_fmi(u16 tid) const {
+    if (fmi_replicas.empty()) return *fmi;
+    const FMIndex *replica = fmi_replicas[opts.thread_node(tid)];
+    return replica != NULL ? *replica : *fmi;
+}
+
+float RefIndex::get_prob_thresh(u64 fmlen) const {
+    return prob_threshes[__builtin_clzll(fmlen)];
+}
+
+float RefIndex::get_source_prob() const {
+    return prob_threshes.front();
+}
+
+IndexRegistry::IndexRegistry() : loading_(false) {}
+
+IndexRegistry::~IndexRegistry() {
+    if (loader_.joinable()) loader_.join();
+
+    std::vector<Freer> freers;
+    {
+        std::lock_guard<std::mutex> lock(registry_mutex);
+        registry_closed = true;
+        freers.swap(freers_);
+    }
+    for (Freer &f : freers) f.thread.join();
+}
+
+bool IndexRegistry::load(const std::string &prefix) {
+    RefIndex *index = new RefIndex();
+    if (!index->load(prefix, IndexOptions(PARAMS))) {
+        index->destroy();
+        delete index;
+        return false;
+    }
+    set(index);
+    return true;
+}
+
+bool IndexRegistry::load_async(const std::string &prefix) {
+    if (loading_.exchange(true)) {
+        std::cerr << "Error: can't load '" << prefix 
+                  << "' while another index is loading\n";
+        return false;
+    }
+
+    if (loader_.joinable()) loader_.join();
+
+    IndexOptions opts(PARAMS);
+    loader_ = std::thread([this, prefix, opts] {
+        Timer t;
+        RefIndex *index = new RefIndex();
+        if (index->load(prefix, opts)) {
+            set(index);
+            std::cerr << "Switched to index '" << prefix << "' after " 
+                      << (t.get() / 1000) << " sec\n";
+        } else {
+            index->destroy();
+            delete index;
+        }
+        loading_ = false;
+    });
+
+    return true;
+}
+
+bool IndexRegistry::is_loading() const {
+    return loading_;
+}
+
+IndexRegistry::Ptr IndexRegistry::get() const {
+    return std::atomic_load(&current_);
+}
+
+void IndexRegistry::set(RefIndex *index) {
+    Ptr ptr(index, [this](const RefIndex *r) {
+        free_index(const_cast<RefIndex *>(r));
+    });
+    std::atomic_store(&current_, ptr);
+}
+
+//Unmapping a large index can take a while, so it's freed on its own
+//thread instead of whichever mapper drops the last reference
+void IndexRegistry::free_index(RefIndex *index) {
+    std::unique_lock<std::mutex> lock(registry_mutex);
+
+    if (registry_closed) {
+        lock.unlock();
+        index->destroy();
+        delete index;
+        return;
+    }
+
+    //Threads that have finished are joined so they don't pile up
+    for (u32 i = 0; i < freers_.size(); ) {
+        if (*freers_[i].done) {
+            freers_[i].thread.join();
+            freers_[i] = std::move(freers_.back());
+            freers_.pop_back();
+        } else {
+            i++;
+        }
+    }
+
+    Freer f;
+    f.done = std::make_shared< std::atomic<bool> >(false);
+    std::shared_ptr< std::atomic<bool> > done = f.done;
+    f.thread = std::thread([index, done] {
+        index->destroy();
+        delete index;
+        *done = true;
+    });
+    freers_.push_back(std::move(f));
+}
+
+bool load_index(const std::string &prefix) {
+    return INDEX_REGISTRY.load_async(prefix);
+}
+
+bool index_loading() {
+    return INDEX_REGISTRY.is_loading();
+}
+
+bool write_index_params(const std::string &bwa_prefix, u8 kmer_len,
+                        const std::vector<std::string> &names,
+                        const std::vector< std::vector<float> > &threshes,
+                        const std::vector<float> &probs,
+                        const std::vector<float> &speeds) {
+    if (kmer_len < MIN_KMER_LEN || kmer_len > MAX_KMER_LEN) {
+        std::cerr << "Error: k-mer length must be between " 
+                  << (int) MIN_KMER_LEN << " and " << (int) MAX_KMER_LEN 
+                  << "\n";
+        return false;
+    }
+    if (threshes.size() != names.size() || probs.size() != names.size() ||
+        speeds.size() != names.size()) {
+        std::cerr << "Error: each preset needs thresholds, a probability "
+                  << "and a speed\n";
+        return false;
+    }
+
+    std::vector<ParamPreset> presets(names.size());
+    for (u64 i = 0; i < names.size(); i++) {
+        ParamPreset &p = presets[i];
+        std::memset(&p, 0, sizeof(p));
+        if (names[i].size() >= sizeof(p.name)) {
+            std::cerr << "Error: preset name '" << names[i] 
+                      << "' is too long\n";
+            return false;
+        }
+        std::memcpy(p.name, names[i].c_str(), names[i].size());
+        p.prob = probs[i];
+        p.speed = speeds[i];
+        expand_threshes(threshes[i], p.threshes);
+    }
+
+    FMIndex *fmi = load_fm_index(bwa_prefix);
+    if (fmi == NULL) {
+        std::cerr << "Error: failed to load index '" << bwa_prefix << "'\n";
+        return false;
+    }
+
+    ParamHeader h;
+    std::memset(&h, 0, sizeof(h));
+    std::memcpy(h.magic, PARAM_MAGIC, sizeof(PARAM_MAGIC));
+    h.version = PARAM_VERSION;
+    h.checksum = index_checksum(*fmi);
+    h.preset_count = presets.size();
+    h.kmer_len = kmer_len;
+
+    std::vector<Range> ranges = get_kmer_ranges(*fmi, kmer_len);
+    fmi->destroy();
+    delete fmi;
+
+    std::string fname = bwa_prefix + INDEX_SUFF,
+                tmp_fname = fname + ".tmp";
+    std::ofstream out(tmp_fname, std::ios::binary);
+    out.write((const char *) &h, sizeof(h));
+    out.write((const char *) presets.data(), 
+              presets.size() * sizeof(ParamPreset));
+    out.write((const char *) ranges.data(), ranges.size() * sizeof(Range));
+    out.close();
+
+    if (!out.good() || rename(tmp_fname.c_str(), fname.c_str()) != 0) {
+        std::cerr << "Error: failed to write '" << fname << "'\n";
+        return false;
+    }
+
+    return true;
+}
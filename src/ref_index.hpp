@@ -0,0 +1,162 @@
+/* MIT License
+ *
+ * Copyright (c) 2018 Sam Kovaka <skovaka@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#ifndef INCL_REF_INDEX
+#define INCL_REF_INDEX
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "fm_index.hpp"
+#include "jump_table.hpp"
+#include "repeat_mask.hpp"
+#include "range.hpp"
+
+#define INDEX_SUFF ".uncl"
+
+//Prefix of the index of sequences added with "uncalled add", relative to
+//the main index prefix
+#define ADDED_SUFF ".add"
+
+class Params;
+
+//Settings an index is loaded with, copied from PARAMS before loading so a
+//load on another thread doesn't read them while they may change
+struct IndexOptions {
+    std::string param_preset;
+    u8 kmer_len;
+    u32 sa_intv, sa_cache_mb;
+    HugePageMode huge_pages;
+    NumaMode numa;
+    std::vector<u32> thread_nodes;
+
+    IndexOptions();
+    IndexOptions(const Params &p);
+
+    i32 thread_node(u16 tid) const;
+};
+
+//Everything mapping needs from one reference: the FM index and its NUMA 
+//replicas, the jump table and repeat mask, k-mer ranges and the 
+//probability thresholds stored in <prefix>.uncl
+class RefIndex {
+    public:
+    RefIndex();
+
+    bool load(const std::string &_prefix, const IndexOptions &_opts);
+    void destroy();
+
+    //Index copy on a mapper thread's node
+    const FMIndex &thread_fmi(u16 tid) const;
+
+    float get_prob_thresh(u64 fm_length) const;
+    float get_source_prob() const;
+
+    std::string prefix;
+    IndexOptions opts;
+    FMIndex *fmi;
+    JumpTable jump_table;
+    RepeatMask repeat_mask;
+    std::vector<FMIndex *> fmi_replicas;
+    std::vector<float> prob_threshes;
+    std::vector<Range> kmer_fmranges;
+
+    //Sequences added since the main index was built, searched alongside
+    //it. NULL if there are none
+    RefIndex *added;
+
+    private:
+    bool load_added(const std::string &_prefix, const RefIndex &main);
+
+    //Loads the jump table and repeat mask if they exist and match fmi
+    void load_tables();
+
+    //Reads the preset's thresholds and k-mer ranges from either format
+    bool load_params(const std::string &fname);
+    bool load_binary_params(const std::string &fname);
+    bool load_text_params(const std::string &fname);
+};
+
+//Writes <prefix>.uncl with each preset's event probability thresholds, 
+//which start from the smallest FM range, along with the ranges of every 
+//k-mer and a checksum of the index they were computed for
+bool write_index_params(const std::string &bwa_prefix, u8 kmer_len,
+                        const std::vector<std::string> &names,
+                        const std::vector< std::vector<float> > &threshes,
+                        const std::vector<float> &probs,
+                        const std::vector<float> &speeds);
+
+//Holds the index that new reads are mapped to. Another index can be 
+//loaded in the background while mapping continues. Mappers switch to it
+//when they start their next read, and the old index is freed once the 
+//last mapper using it moves on
+class IndexRegistry {
+    public:
+    typedef std::shared_ptr<const RefIndex> Ptr;
+
+    IndexRegistry();
+    ~IndexRegistry();
+
+    //Loads an index with the settings in PARAMS and makes it current 
+    //before returning. The current index is kept if loading fails
+    bool load(const std::string &prefix);
+
+    //Starts loading an index on another thread, which becomes current 
+    //once loaded. Fails if another load is in progress
+    bool load_async(const std::string &prefix);
+
+    bool is_loading() const;
+
+    Ptr get() const;
+
+    private:
+    void set(RefIndex *index);
+
+    //Frees a replaced index on its own thread, which is joined by the 
+    //next call or the destructor
+    void free_index(RefIndex *index);
+
+    struct Freer {
+        std::thread thread;
+        std::shared_ptr< std::atomic<bool> > done;
+    };
+
+    Ptr current_;
+    std::thread loader_;
+    std::atomic<bool> loading_;
+    std::vector<Freer> freers_;
+};
+
+extern IndexRegistry INDEX_REGISTRY;
+
+//Switches realtime mapping to another reference without stopping. Fails
+//if another index is still loading
+bool load_index(const std::string &prefix);
+
+bool index_loading();
+
+#endif
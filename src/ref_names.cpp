@@ -0,0 +1,57 @@
+/* MIT License
+ *
+ * Copyright (c) 2018 Sam Kovaka <skovaka@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include "ref_names.hpp"
+
+RefNames::RefNames(const bntseq_t *bns) 
+    : bucket_shift_(0),
+      seq_len_(0) {
+
+    u32 n = bns->n_seqs;
+    names_.reserve(n);
+    offsets_.reserve(n + 1);
+    for (u32 i = 0; i < n; i++) {
+        names_.emplace_back(bns->anns[i].name);
+        offsets_.push_back(bns->anns[i].offset);
+    }
+    seq_len_ = bns->l_pac;
+    offsets_.push_back(seq_len_);
+
+    //Roughly one bucket per contig
+    while ((seq_len_ >> bucket_shift_) > n) bucket_shift_++;
+
+    u64 nbuckets = (seq_len_ >> bucket_shift_) + 1;
+    buckets_.resize(nbuckets + 1);
+    u32 id = 0;
+    for (u64 b = 0; b < nbuckets; b++) {
+        u64 loc = b << bucket_shift_;
+        while (id + 1 < n && offsets_[id+1] <= loc) id++;
+        buckets_[b] = id;
+    }
+    buckets_[nbuckets] = n > 0 ? n - 1 : 0;
+}
+
+u32 RefNames::size() const {
+    return names_.size();
+}
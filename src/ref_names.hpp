@@ -0,0 +1,86 @@
+/* MIT License
+ *
+ * Copyright (c) 2018 Sam Kovaka <skovaka@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#ifndef INCL_REF_NAMES
+#define INCL_REF_NAMES
+
+#include <string>
+#include <vector>
+#include <memory>
+#include "util.hpp"
+#include "bwa/bntseq.h"
+
+//Contig names, offsets and lengths, copied from the bwa annotations once 
+//at load time. Mapped reads only store a contig id and names are looked 
+//up when output is written. Shared between the index and its Pafs, so 
+//names stay valid after the index is swapped out
+class RefNames {
+    public:
+
+    typedef std::shared_ptr<const RefNames> Ptr;
+
+    RefNames(const bntseq_t *bns);
+
+    u32 size() const;
+
+    //Id of the contig containing the packed sequence position loc, or -1 
+    //if loc is outside the forward strand
+    inline i32 get_id(u64 loc) const {
+        if (loc >= seq_len_) return -1;
+        u64 b = loc >> bucket_shift_;
+        u32 lo = buckets_[b], hi = buckets_[b+1];
+        while (lo < hi) {
+            u32 mid = (lo + hi + 1) >> 1;
+            if (offsets_[mid] <= loc) lo = mid;
+            else hi = mid - 1;
+        }
+        return lo;
+    }
+
+    inline const std::string &get_name(u32 id) const {
+        return names_[id];
+    }
+
+    inline u64 get_offset(u32 id) const {
+        return offsets_[id];
+    }
+
+    inline u64 get_len(u32 id) const {
+        return offsets_[id+1] - offsets_[id];
+    }
+
+    private:
+    std::vector<std::string> names_;
+
+    //offsets_[i] is the start of contig i, with seq_len_ appended
+    std::vector<u64> offsets_;
+
+    //buckets_[b] is the contig containing position b << bucket_shift_, 
+    //so each lookup only searches the contigs within one bucket
+    std::vector<u32> buckets_;
+    u8 bucket_shift_;
+    u64 seq_len_;
+};
+
+#endif
@@ -0,0 +1,313 @@
+/* MIT License
+ *
+ * Copyright (c) 2018 Sam Kovaka <skovaka@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include <cstring>
+#include <cstdio>
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+#include <thread>
+#include <atomic>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "repeat_mask.hpp"
+
+struct RepeatHeader {
+    char magic[8];
+    u64 version,
+        seq_len,
+        min_len,
+        count,
+        checksum,
+        reserved[2];
+};
+
+static const char REPEAT_MAGIC[8] = {'U','N','C','L','R','E','P','\0'};
+static const u64 REPEAT_VERSION = 2;
+
+//Reference positions are split into blocks which threads claim in turn
+static const u64 BLOCK_LEN = 1 << 16;
+
+RepeatMask::RepeatMask()
+    : intervals_(NULL),
+      count_(0),
+      mmap_buf_(NULL),
+      mmap_len_(0),
+      seq_len_(0),
+      checksum_(0),
+      min_len_(0) {}
+
+//Marks rows st to en. Ranges of distinct sequences with the same length
+//are disjoint, so if st is already marked the whole range is
+static void mark_rows(std::vector<u64> &bits, u64 st, u64 en) {
+    u64 ws = st >> 6, we = en >> 6;
+
+    if (__atomic_load_n(&bits[ws], __ATOMIC_RELAXED) & (1ull << (st & 63))) {
+        return;
+    }
+
+    u64 st_mask = ~0ull << (st & 63),
+        en_mask = ~0ull >> (63 - (en & 63));
+
+    if (ws == we) {
+        __atomic_fetch_or(&bits[ws], st_mask & en_mask, __ATOMIC_RELAXED);
+        return;
+    }
+
+    __atomic_fetch_or(&bits[ws], st_mask, __ATOMIC_RELAXED);
+    for (u64 w = ws + 1; w < we; w++) {
+        __atomic_store_n(&bits[w], ~0ull, __ATOMIC_RELAXED);
+    }
+    __atomic_fetch_or(&bits[we], en_mask, __ATOMIC_RELAXED);
+}
+
+//Position of the first bit from i equal to val, or n if there is none
+static u64 next_bit(const std::vector<u64> &bits, u64 i, u64 n, bool val) {
+    u64 w = i >> 6, flip = val ? 0 : ~0ull;
+    if (w >= bits.size()) return n;
+
+    u64 word = (bits[w] ^ flip) & (~0ull << (i & 63));
+    while (word == 0) {
+        if (++w >= bits.size()) return n;
+        word = bits[w] ^ flip;
+    }
+    return std::min(n, (w << 6) + __builtin_ctzll(word));
+}
+
+bool RepeatMask::build(const FMIndex &fmi, const std::string &fasta_fname,
+                       u32 min_len, u16 threads) {
+    if (min_len < 2) {
+        std::cerr << "Error: repeat length must be at least 2\n";
+        return false;
+    }
+
+    std::ifstream fasta_in(fasta_fname);
+    if (!fasta_in.is_open()) {
+        std::cerr << "Error: failed to open '" << fasta_fname << "'\n";
+        return false;
+    }
+
+    //Non-ACGT bases are stored as 4 and end any repeat
+    std::vector< std::vector<u8> > seqs;
+    std::string fasta_line;
+    while (getline(fasta_in, fasta_line)) {
+        if (fasta_line[0] == '>') {
+            seqs.push_back(std::vector<u8>());
+        } else if (!seqs.empty()) {
+            for (char c : fasta_line) {
+                seqs.back().push_back((u8) c < 128 ? BASE_BYTES[(u8)c] : 4);
+            }
+        }
+    }
+
+    std::vector< std::pair<u32, u64> > blocks;
+    for (u32 s = 0; s < seqs.size(); s++) {
+        for (u64 i = 0; i < seqs[s].size(); i += BLOCK_LEN) {
+            blocks.emplace_back(s, i);
+        }
+    }
+
+    u64 nrows = fmi.size() + 1;
+    std::vector<u64> bits((nrows + 63) / 64, 0);
+    std::atomic<u64> next_block(0);
+
+    //Backward search extends patterns to the left, so the reverse strand 
+    //of seq[i,i+min_len) is matched by feeding complemented bases left 
+    //to right and the forward strand by feeding bases right to left
+    auto mark_blocks = [&]() {
+        while (true) {
+            u64 b = next_block++;
+            if (b >= blocks.size()) break;
+
+            const std::vector<u8> &seq = seqs[blocks[b].first];
+            u64 en = std::min(blocks[b].second + BLOCK_LEN, (u64) seq.size());
+
+            for (u64 i = blocks[b].second; i < en && i + min_len <= seq.size(); i++) {
+                for (u8 fwd = 0; fwd < 2; fwd++) {
+                    u8 base = fwd ? seq[i + min_len - 1] : seq[i];
+                    if (base > 3) continue;
+                    if (!fwd) base = BASE_COMP_B[base];
+
+                    Range r = fmi.get_full_range(base);
+                    u32 j = 1;
+                    for (; j < min_len && r.length() > 1; j++) {
+                        base = fwd ? seq[i + min_len - 1 - j] : seq[i + j];
+                        if (base > 3) break;
+                        if (!fwd) base = BASE_COMP_B[base];
+                        r = fmi.get_neighbor(r, base);
+                    }
+
+                    if (j == min_len && r.length() > 1) {
+                        mark_rows(bits, r.start_, r.end_);
+                    }
+                }
+            }
+        }
+    };
+
+    if (threads == 0) threads = 1;
+    std::vector<std::thread> pool;
+    for (u16 t = 1; t < threads; t++) {
+        pool.emplace_back(mark_blocks);
+    }
+    mark_blocks();
+    for (auto &t : pool) t.join();
+
+    buf_.clear();
+    u64 st = next_bit(bits, 0, nrows, true);
+    while (st < nrows) {
+        u64 en = next_bit(bits, st, nrows, false);
+        buf_.push_back(Range(st, en - 1));
+        st = next_bit(bits, en, nrows, true);
+    }
+
+    intervals_ = buf_.data();
+    count_ = buf_.size();
+    seq_len_ = fmi.size();
+    checksum_ = index_checksum(fmi);
+    min_len_ = min_len;
+
+    return true;
+}
+
+bool RepeatMask::load(const std::string &fname, const FMIndex &fmi) {
+    int fd = open(fname.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (u64) st.st_size < sizeof(RepeatHeader)) {
+        close(fd);
+        return false;
+    }
+
+    void *buf = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (buf == MAP_FAILED) {
+        std::cerr << "Error: failed to mmap '" << fname << "'\n";
+        return false;
+    }
+
+    const RepeatHeader *h = (const RepeatHeader *) buf;
+    if (std::memcmp(h->magic, REPEAT_MAGIC, sizeof(REPEAT_MAGIC)) != 0 ||
+        h->version != REPEAT_VERSION || 
+        h->seq_len != fmi.size() || 
+        sizeof(RepeatHeader) + h->count * sizeof(Range) != (u64) st.st_size ||
+        h->checksum != index_checksum(fmi)) {
+
+        std::cerr << "Error: '" << fname << "' does not match index, "
+                  << "not using repeat mask\n";
+        munmap(buf, st.st_size);
+        return false;
+    }
+
+    mmap_buf_ = buf;
+    mmap_len_ = st.st_size;
+    seq_len_ = h->seq_len;
+    checksum_ = h->checksum;
+    min_len_ = h->min_len;
+    count_ = h->count;
+    intervals_ = (const Range *) ((const u8 *) buf + sizeof(RepeatHeader));
+
+    return true;
+}
+
+bool RepeatMask::save(const std::string &fname) const {
+    RepeatHeader h;
+    std::memset(&h, 0, sizeof(h));
+    std::memcpy(h.magic, REPEAT_MAGIC, sizeof(REPEAT_MAGIC));
+    h.version = REPEAT_VERSION;
+    h.seq_len = seq_len_;
+    h.min_len = min_len_;
+    h.count = count_;
+    h.checksum = checksum_;
+
+    std::string tmp_fname = fname + ".tmp";
+    std::ofstream out(tmp_fname, std::ios::binary);
+    out.write((const char *) &h, sizeof(h));
+    out.write((const char *) intervals_, count_ * sizeof(Range));
+    out.close();
+
+    if (!out.good() || rename(tmp_fname.c_str(), fname.c_str()) != 0) {
+        std::cerr << "Error: failed to write '" << fname << "'\n";
+        return false;
+    }
+
+    return true;
+}
+
+void RepeatMask::destroy() {
+    std::vector<Range>().swap(buf_);
+    if (mmap_buf_ != NULL) {
+        munmap(mmap_buf_, mmap_len_);
+        mmap_buf_ = NULL;
+    }
+    intervals_ = NULL;
+    count_ = 0;
+    min_len_ = 0;
+}
+
+//Intervals are maximal, so a masked range is within a single interval
+bool RepeatMask::contains(u64 start, u64 end) const {
+    if (count_ == 0) return false;
+
+    const Range *iv = std::upper_bound(intervals_, intervals_ + count_, start,
+        [](u64 loc, const Range &r) { return loc < r.start_; });
+
+    if (iv == intervals_) return false;
+    return end <= (iv - 1)->end_;
+}
+
+u64 RepeatMask::interval_count() const {
+    return count_;
+}
+
+u32 RepeatMask::min_len() const {
+    return min_len_;
+}
+
+bool write_repeat_mask(const std::string &bwa_prefix, 
+                       const std::string &fasta_fname, 
+                       u32 min_len, u16 threads) {
+    FMIndex *fmi = load_fm_index(bwa_prefix);
+    if (fmi == NULL) {
+        std::cerr << "Error: failed to load index '" << bwa_prefix << "'\n";
+        return false;
+    }
+    RepeatMask mask;
+
+    bool ret = mask.build(*fmi, fasta_fname, min_len, threads) && 
+               mask.save(bwa_prefix + REPEAT_SUFF);
+
+    if (ret) {
+        std::cerr << "Masked " << mask.interval_count() 
+                  << " repeat intervals\n";
+    }
+
+    mask.destroy();
+    fmi->destroy();
+    delete fmi;
+    return ret;
+}
@@ -0,0 +1,82 @@
+/* MIT License
+ *
+ * Copyright (c) 2018 Sam Kovaka <skovaka@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#ifndef INCL_REPEAT_MASK
+#define INCL_REPEAT_MASK
+
+#include <string>
+#include <vector>
+#include "util.hpp"
+#include "range.hpp"
+#include "fm_index.hpp"
+
+#define REPEAT_SUFF ".urep"
+
+//Suffix array rows whose first min_len bases occur more than once in the
+//index, stored as sorted disjoint row intervals. A seed range inside the
+//mask only matches within repeats at least min_len long, so mapping can 
+//skip locating it
+class RepeatMask {
+    public:
+
+    RepeatMask();
+
+    //Self-aligns both strands of the reference from every position
+    bool build(const FMIndex &fmi, const std::string &fasta_fname, 
+               u32 min_len, u16 threads);
+
+    //Memory-maps a mask written by save(). Fails if it was built for a 
+    //different index, checked by index_checksum
+    bool load(const std::string &fname, const FMIndex &fmi);
+
+    bool save(const std::string &fname) const;
+
+    void destroy();
+
+    //True if every row from start to end is masked
+    bool contains(u64 start, u64 end) const;
+
+    u64 interval_count() const;
+
+    //Repeat length the mask was built for, or 0 if not loaded
+    u32 min_len() const;
+
+    private:
+    std::vector<Range> buf_;
+    const Range *intervals_;
+    u64 count_;
+    void *mmap_buf_;
+    u64 mmap_len_, seq_len_;
+
+    //index_checksum of the index the mask was built from
+    u64 checksum_;
+    u32 min_len_;
+};
+
+//Writes <prefix>.urep for repeats of at least min_len bases
+bool write_repeat_mask(const std::string &bwa_prefix, 
+                       const std::string &fasta_fname, 
+                       u32 min_len, u16 threads);
+
+#endif
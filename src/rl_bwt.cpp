@@ -0,0 +1,624 @@
+/* MIT License
+ *
+ * Copyright (c) 2018 Sam Kovaka <skovaka@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include <cstring>
+#include <cstdio>
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "rl_bwt.hpp"
+#include "bwa_fmi.hpp"
+
+//Header of the .urlb file, followed by each array in the order listed by
+//get_arrays(). Every array is a whole number of words, so all stay aligned
+struct RLBWTHeader {
+    char magic[8];
+    u64 version,
+        seq_len,
+        primary,
+        L2[ALPH_SIZE+1],
+        runs,
+        row_shift,
+        pos_shift,
+        lens[12],
+        widths[12],
+        reserved[4];
+};
+
+static const char RLBWT_MAGIC[8] = {'U','N','C','L','R','L','B','\0'};
+static const u64 RLBWT_VERSION = 1;
+
+RunLengthBWT::RunLengthBWT()
+    : seq_len_(0),
+      primary_(0),
+      runs_(0),
+      row_shift_(0),
+      pos_shift_(0),
+      double_stranded_(true),
+      mmap_buf_(NULL),
+      mmap_len_(0) {
+    std::memset(L2_, 0, sizeof(L2_));
+}
+
+RunLengthBWT::RunLengthBWT(const std::string &prefix) : RunLengthBWT() {
+    std::string fname = prefix + RLBWT_SUFF;
+    if (!load(fname)) return;
+
+    bntseq_t *bns = bns_restore(prefix.c_str());
+    if (!index_matches_ref(prefix, bns, seq_len_, primary_, L2_)) {
+        std::cerr << "Error: '" << fname << "' was not built from the "
+                  << "current reference, rebuild it with 'uncalled index'\n";
+        destroy();
+    } else {
+        names_ = std::make_shared<const RefNames>(bns);
+        double_stranded_ = 2 * u64(bns->l_pac) == seq_len_;
+    }
+    if (bns != NULL) bns_destroy(bns);
+}
+
+void RunLengthBWT::get_arrays(PackedArray *arrays[ARRAY_COUNT]) {
+    PackedArray *list[ARRAY_COUNT] = {
+        &heads_, &bases_, &counts_, &row_buckets_, &head_sa_, &tail_sa_,
+        &phi_pos_, &phi_val_, &phi_buckets_, &inv_pos_, &inv_val_, &inv_buckets_
+    };
+    std::memcpy(arrays, list, sizeof(list));
+}
+
+//Shift giving about one sorted value per bucket
+static u8 bucket_shift(u64 max_val, u64 count) {
+    u8 vb = PackedArray::bits_needed(max_val), 
+       cb = PackedArray::bits_needed(count);
+    return vb > cb ? vb - cb : 0;
+}
+
+//Sets bucket b to the number of values less than b << shift
+static bool init_buckets(const std::vector<u64> &sorted, u64 max_val, 
+                         u8 shift, PackedArray &buckets) {
+    u64 n = (max_val >> shift) + 2;
+    if (!buckets.init(n, PackedArray::bits_needed(sorted.size()))) {
+        return false;
+    }
+
+    u64 i = 0;
+    for (u64 b = 0; b < n; b++) {
+        while (i < sorted.size() && sorted[i] < (b << shift)) i++;
+        buckets.set(b, i);
+    }
+    return true;
+}
+
+static bool init_array(const std::vector<u64> &vals, u64 max_val, 
+                       PackedArray &array) {
+    if (!array.init(vals.size(), PackedArray::bits_needed(max_val))) {
+        return false;
+    }
+    for (u64 i = 0; i < vals.size(); i++) {
+        array.set(i, vals[i]);
+    }
+    return true;
+}
+
+//Index of the last sorted value not greater than x. The first value must
+//be 0, and x must not exceed the maximum the buckets were made for
+static inline u64 pred(const PackedArray &vals, const PackedArray &buckets, 
+                       u8 shift, u64 x) {
+    u64 b = x >> shift,
+        lo = buckets.get(b),
+        hi = buckets.get(b+1);
+
+    while (lo < hi) {
+        u64 mid = (lo + hi) / 2;
+        if (vals.get(mid) <= x) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo - 1;
+}
+
+bool RunLengthBWT::build(const BwaFMI &fmi) {
+    destroy();
+
+    names_ = fmi.get_names();
+    double_stranded_ = fmi.is_double_stranded();
+
+    seq_len_ = fmi.size();
+    for (u8 c = 0; c < ALPH_SIZE; c++) {
+        L2_[c] = fmi.get_full_range(c).start_;
+    }
+    L2_[ALPH_SIZE] = seq_len_;
+
+    //'$' is always a run of its own
+    std::vector<u64> heads, bases;
+    u8 prev = ALPH_SIZE + 1;
+    for (u64 k = 0; k <= seq_len_; k++) {
+        u8 c = fmi.bwt_base(k);
+        if (c == ALPH_SIZE) primary_ = k;
+        if (c != prev || c == ALPH_SIZE) {
+            heads.push_back(k);
+            bases.push_back(c);
+        }
+        prev = c;
+    }
+    runs_ = heads.size();
+    heads.push_back(seq_len_ + 1);
+
+    row_shift_ = bucket_shift(seq_len_ + 1, runs_);
+
+    std::vector<u64> counts;
+    u64 cnt[ALPH_SIZE] = {0, 0, 0, 0};
+    for (u64 r = 0; r < runs_; r++) {
+        if (r % BLOCK_RUNS == 0) counts.insert(counts.end(), cnt, cnt + ALPH_SIZE);
+        if (bases[r] < ALPH_SIZE) cnt[bases[r]] += heads[r+1] - heads[r];
+    }
+
+    if (!init_array(heads, seq_len_ + 1, heads_) ||
+        !init_array(bases, ALPH_SIZE, bases_) ||
+        !init_array(counts, seq_len_, counts_) ||
+        !init_buckets(heads, seq_len_ + 1, row_shift_, row_buckets_)) {
+        destroy();
+        return false;
+    }
+
+    //Walk the whole text backwards with LF, recording the position of
+    //rows at either end of a run. Row 0 is the empty suffix
+    std::vector<u64> ends((seq_len_ >> 6) + 1, 0);
+    for (u64 r = 0; r < runs_; r++) {
+        ends[heads[r] >> 6] |= 1ull << (heads[r] & 63);
+        ends[(heads[r+1]-1) >> 6] |= 1ull << ((heads[r+1]-1) & 63);
+    }
+
+    std::vector<u64> head_sa(runs_), tail_sa(runs_);
+    u64 k = 0, pos = seq_len_;
+    while (true) {
+        if (ends[k >> 6] & (1ull << (k & 63))) {
+            u64 r = find_run(k);
+            if (heads[r] == k)     head_sa[r] = pos;
+            if (heads[r+1] == k+1) tail_sa[r] = pos;
+        }
+        if (pos == 0) break;
+        k = lf(k);
+        pos--;
+    }
+    std::vector<u64>().swap(ends);
+
+    if (!init_array(head_sa, seq_len_, head_sa_) ||
+        !init_array(tail_sa, seq_len_, tail_sa_)) {
+        destroy();
+        return false;
+    }
+
+    //The matrix is cyclic, so the row before row 0 is the last row
+    std::vector< std::pair<u64, u64> > phi(runs_), inv(runs_);
+    for (u64 r = 0; r < runs_; r++) {
+        phi[r] = std::make_pair(head_sa[r], tail_sa[(r + runs_ - 1) % runs_]);
+        inv[r] = std::make_pair(tail_sa[r], head_sa[(r + 1) % runs_]);
+    }
+    std::sort(phi.begin(), phi.end());
+    std::sort(inv.begin(), inv.end());
+
+    pos_shift_ = bucket_shift(seq_len_, runs_);
+
+    std::vector<u64> locs(runs_), vals(runs_);
+    for (u32 i = 0; i < 2; i++) {
+        std::vector< std::pair<u64, u64> > &samples = i == 0 ? phi : inv;
+        for (u64 r = 0; r < runs_; r++) {
+            locs[r] = samples[r].first;
+            vals[r] = samples[r].second;
+        }
+
+        PackedArray &pos_arr = i == 0 ? phi_pos_ : inv_pos_,
+                    &val_arr = i == 0 ? phi_val_ : inv_val_,
+                    &buckets = i == 0 ? phi_buckets_ : inv_buckets_;
+
+        if (!init_array(locs, seq_len_, pos_arr) ||
+            !init_array(vals, seq_len_, val_arr) ||
+            !init_buckets(locs, seq_len_, pos_shift_, buckets)) {
+            destroy();
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool RunLengthBWT::load(const std::string &fname) {
+    int fd = open(fname.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (u64) st.st_size < sizeof(RLBWTHeader)) {
+        close(fd);
+        return false;
+    }
+
+    void *buf = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (buf == MAP_FAILED) {
+        std::cerr << "Error: failed to mmap '" << fname << "'\n";
+        return false;
+    }
+
+    const RLBWTHeader *h = (const RLBWTHeader *) buf;
+    u64 total = sizeof(RLBWTHeader);
+    for (u32 i = 0; i < ARRAY_COUNT; i++) {
+        total += PackedArray::byte_size(h->lens[i], h->widths[i]);
+    }
+
+    if (std::memcmp(h->magic, RLBWT_MAGIC, sizeof(RLBWT_MAGIC)) != 0 ||
+        h->version != RLBWT_VERSION ||
+        h->seq_len == 0 || h->runs == 0 || h->primary > h->seq_len ||
+        h->L2[0] != 0 || h->L2[ALPH_SIZE] != h->seq_len ||
+        total != (u64) st.st_size) {
+
+        std::cerr << "Error: '" << fname << "' is invalid or out of date\n";
+        munmap(buf, st.st_size);
+        return false;
+    }
+
+    madvise(buf, st.st_size, MADV_RANDOM);
+
+    mmap_buf_ = buf;
+    mmap_len_ = st.st_size;
+
+    seq_len_ = h->seq_len;
+    primary_ = h->primary;
+    std::memcpy(L2_, h->L2, sizeof(L2_));
+    runs_ = h->runs;
+    row_shift_ = h->row_shift;
+    pos_shift_ = h->pos_shift;
+
+    PackedArray *arrays[ARRAY_COUNT];
+    get_arrays(arrays);
+
+    const u8 *data = (const u8 *) buf + sizeof(RLBWTHeader);
+    for (u32 i = 0; i < ARRAY_COUNT; i++) {
+        arrays[i]->init(data, h->lens[i], h->widths[i]);
+        data += arrays[i]->byte_size();
+    }
+
+    return true;
+}
+
+bool RunLengthBWT::save(const std::string &fname) const {
+    RLBWTHeader h;
+    std::memset(&h, 0, sizeof(h));
+    std::memcpy(h.magic, RLBWT_MAGIC, sizeof(RLBWT_MAGIC));
+    h.version = RLBWT_VERSION;
+    h.seq_len = seq_len_;
+    h.primary = primary_;
+    std::memcpy(h.L2, L2_, sizeof(L2_));
+    h.runs = runs_;
+    h.row_shift = row_shift_;
+    h.pos_shift = pos_shift_;
+
+    PackedArray *arrays[ARRAY_COUNT];
+    const_cast<RunLengthBWT *>(this)->get_arrays(arrays);
+    for (u32 i = 0; i < ARRAY_COUNT; i++) {
+        h.lens[i] = arrays[i]->size();
+        h.widths[i] = arrays[i]->width();
+    }
+
+    std::string tmp_fname = fname + ".tmp";
+    std::ofstream out(tmp_fname, std::ios::binary);
+    out.write((const char *) &h, sizeof(h));
+    for (u32 i = 0; i < ARRAY_COUNT; i++) {
+        out.write((const char *) arrays[i]->data(), arrays[i]->byte_size());
+    }
+    out.close();
+
+    if (!out.good() || rename(tmp_fname.c_str(), fname.c_str()) != 0) {
+        std::cerr << "Error: failed to write '" << fname << "'\n";
+        return false;
+    }
+
+    return true;
+}
+
+void RunLengthBWT::destroy() {
+    PackedArray *arrays[ARRAY_COUNT];
+    get_arrays(arrays);
+    for (u32 i = 0; i < ARRAY_COUNT; i++) {
+        arrays[i]->destroy();
+    }
+
+    if (mmap_buf_ != NULL) {
+        munmap(mmap_buf_, mmap_len_);
+        mmap_buf_ = NULL;
+    }
+    names_.reset();
+    runs_ = 0;
+}
+
+FMIndex *RunLengthBWT::replicate(HugePageMode mode, u32 node, 
+                                 HugePageMode *used) const {
+    RunLengthBWT *dst = new RunLengthBWT(*this);
+    dst->mmap_buf_ = NULL;
+    dst->mmap_len_ = 0;
+
+    PackedArray *src_arrays[ARRAY_COUNT], *dst_arrays[ARRAY_COUNT];
+    const_cast<RunLengthBWT *>(this)->get_arrays(src_arrays);
+    dst->get_arrays(dst_arrays);
+
+    HugePageMode min_used = mode;
+    for (u32 i = 0; i < ARRAY_COUNT; i++) {
+        HugePageMode arr_used;
+        if (!src_arrays[i]->copy(*dst_arrays[i], mode, node, &arr_used)) {
+            for (u32 j = 0; j < i; j++) dst_arrays[j]->destroy();
+            delete dst;
+            return NULL;
+        }
+        if (arr_used < min_used) min_used = arr_used;
+    }
+
+    if (used != NULL) *used = min_used;
+    return dst;
+}
+
+HugePageMode RunLengthBWT::move_to(HugePageMode mode, i32 node) {
+    PackedArray *arrays[ARRAY_COUNT];
+    get_arrays(arrays);
+
+    HugePageMode min_used = mode;
+    for (u32 i = 0; i < ARRAY_COUNT; i++) {
+        HugePageMode used = arrays[i]->move_to(mode, node);
+        if (used < min_used) min_used = used;
+    }
+
+    if (mmap_buf_ != NULL) {
+        munmap(mmap_buf_, mmap_len_);
+        mmap_buf_ = NULL;
+    }
+
+    return min_used;
+}
+
+u64 RunLengthBWT::find_run(u64 k) const {
+    return pred(heads_, row_buckets_, row_shift_, k);
+}
+
+u64 RunLengthBWT::count_before(u64 run, u8 c) const {
+    u64 r = run - run % BLOCK_RUNS,
+        cnt = counts_.get(r / BLOCK_RUNS * ALPH_SIZE + c),
+        st = heads_.get(r);
+
+    for (; r < run; r++) {
+        u64 en = heads_.get(r+1);
+        if (bases_.get(r) == c) cnt += en - st;
+        st = en;
+    }
+    return cnt;
+}
+
+u64 RunLengthBWT::occ(u64 k, u8 c) const {
+    if (k == u64(-1)) return 0;
+
+    u64 run = find_run(k),
+        cnt = count_before(run, c);
+    if (bases_.get(run) == c) cnt += k - heads_.get(run) + 1;
+    return cnt;
+}
+
+void RunLengthBWT::occ4(u64 k, u64 cnt[ALPH_SIZE]) const {
+    if (k == u64(-1)) {
+        cnt[0] = cnt[1] = cnt[2] = cnt[3] = 0;
+        return;
+    }
+
+    u64 run = find_run(k), 
+        r = run - run % BLOCK_RUNS,
+        st = heads_.get(r);
+
+    //Extra slot for the primary row's base, which isn't counted
+    u64 all[ALPH_SIZE+1] = {0, 0, 0, 0, 0};
+    for (u8 c = 0; c < ALPH_SIZE; c++) {
+        all[c] = counts_.get(r / BLOCK_RUNS * ALPH_SIZE + c);
+    }
+
+    for (; r < run; r++) {
+        u64 en = heads_.get(r+1);
+        all[bases_.get(r)] += en - st;
+        st = en;
+    }
+    all[bases_.get(run)] += k - st + 1;
+
+    std::memcpy(cnt, all, ALPH_SIZE * sizeof(u64));
+}
+
+u8 RunLengthBWT::get_base(u64 k) const {
+    return bases_.get(find_run(k));
+}
+
+void RunLengthBWT::prefetch_row(u64 k) const {
+    u64 bit = (k >> row_shift_) * row_buckets_.width();
+    __builtin_prefetch((const u8 *) row_buckets_.data() + (bit >> 3));
+}
+
+//LF-mapping, same as bwa's bwt_invPsi
+u64 RunLengthBWT::lf(u64 k) const {
+    if (k == primary_) return 0;
+    u64 run = find_run(k);
+    u8 c = bases_.get(run);
+    return L2_[c] + count_before(run, c) + (k - heads_.get(run)) + 1;
+}
+
+//Positions are cyclic, with seq_len_ standing for the '$' at the end
+u64 RunLengthBWT::phi(u64 loc) const {
+    u64 i = pred(phi_pos_, phi_buckets_, pos_shift_, loc),
+        val = phi_val_.get(i) + (loc - phi_pos_.get(i));
+    return val > seq_len_ ? val - seq_len_ - 1 : val;
+}
+
+u64 RunLengthBWT::phi_inv(u64 loc) const {
+    u64 i = pred(inv_pos_, inv_buckets_, pos_shift_, loc),
+        val = inv_val_.get(i) + (loc - inv_pos_.get(i));
+    return val > seq_len_ ? val - seq_len_ - 1 : val;
+}
+
+//Row arithmetic is done in 64 bits so start_ - 1 can't wrap for 
+//32-bit ranges
+template <typename T>
+BasicRange<T> RunLengthBWT::extend(BasicRange<T> r1, u8 base) const {
+    u64 os = occ(u64(r1.start_) - 1, base),
+        oe = occ(r1.end_, base);
+    return BasicRange<T>(L2_[base] + os + 1, L2_[base] + oe);
+}
+
+template <typename T>
+void RunLengthBWT::extend_all(BasicRange<T> r1, 
+                              BasicRange<T> out[ALPH_SIZE]) const {
+    u64 os[ALPH_SIZE], oe[ALPH_SIZE];
+    occ4(u64(r1.start_) - 1, os);
+    occ4(r1.end_, oe);
+    for (u8 b = 0; b < ALPH_SIZE; b++) {
+        out[b] = BasicRange<T>(L2_[b] + os[b] + 1, L2_[b] + oe[b]);
+    }
+}
+
+Range RunLengthBWT::get_neighbor(Range r1, u8 base) const {
+    return extend(r1, base);
+}
+
+Range32 RunLengthBWT::get_neighbor(Range32 r1, u8 base) const {
+    return extend(r1, base);
+}
+
+void RunLengthBWT::get_neighbors(Range r1, Range out[ALPH_SIZE]) const {
+    extend_all(r1, out);
+}
+
+void RunLengthBWT::get_neighbors(Range32 r1, Range32 out[ALPH_SIZE]) const {
+    extend_all(r1, out);
+}
+
+void RunLengthBWT::prefetch(Range r1) const {
+    prefetch_row(u64(r1.start_) - 1);
+    prefetch_row(r1.end_);
+}
+
+void RunLengthBWT::prefetch(Range32 r1) const {
+    prefetch_row(u64(r1.start_) - 1);
+    prefetch_row(r1.end_);
+}
+
+Range RunLengthBWT::get_full_range(u8 base) const {
+    return Range(L2_[base], L2_[base+1]);
+}
+
+u64 RunLengthBWT::sa(u64 i) const {
+    u64 loc;
+    sa_range(i, i, &loc);
+    return loc;
+}
+
+void RunLengthBWT::sa_range(u64 st, u64 en, u64 *locs) const {
+    u64 s = st, e = en, steps = 0, row, loc;
+
+    //Every row of a range within one run maps to consecutive rows, so the
+    //whole range is shifted by one LF step until it contains the first 
+    //or last row of a run. The primary row is its own run
+    while (true) {
+        u64 run = find_run(e),
+            head = heads_.get(run);
+
+        if (head >= s) {
+            row = head;
+            loc = head_sa_.get(run);
+            break;
+        }
+        if (heads_.get(run+1) == e + 1) {
+            row = e;
+            loc = tail_sa_.get(run);
+            break;
+        }
+
+        u8 c = bases_.get(run);
+        s = L2_[c] + count_before(run, c) + (s - head) + 1;
+        e = s + (en - st);
+        steps++;
+    }
+
+    //Row 0 is the empty suffix, so its position wraps past the end
+    loc = (loc + steps) % (seq_len_ + 1);
+
+    u64 i = row - s, n = en - st;
+    locs[i] = loc;
+    for (u64 j = i; j > 0; j--) {
+        locs[j-1] = phi(locs[j]);
+    }
+    for (u64 j = i; j < n; j++) {
+        locs[j+1] = phi_inv(locs[j]);
+    }
+}
+
+u64 RunLengthBWT::size() const {
+    return seq_len_;
+}
+
+u64 RunLengthBWT::run_count() const {
+    return runs_;
+}
+
+bool RunLengthBWT::is_loaded() const {
+    return runs_ > 0;
+}
+
+bool RunLengthBWT::is_double_stranded() const {
+    return double_stranded_;
+}
+
+u64 RunLengthBWT::byte_size() const {
+    PackedArray *arrays[ARRAY_COUNT];
+    const_cast<RunLengthBWT *>(this)->get_arrays(arrays);
+
+    u64 total = 0;
+    for (u32 i = 0; i < ARRAY_COUNT; i++) {
+        total += arrays[i]->byte_size();
+    }
+    return total;
+}
+
+bool write_rlbwt(const std::string &prefix) {
+    BwaFMI fmi(prefix);
+    if (!fmi.is_loaded()) {
+        std::cerr << "Error: failed to load index '" << prefix << "'\n";
+        return false;
+    }
+
+    RunLengthBWT rl;
+    bool ret = rl.build(fmi) && rl.save(prefix + RLBWT_SUFF);
+
+    if (ret) {
+        std::cerr << "Encoded " << (fmi.size() + 1) << " rows in " 
+                  << rl.run_count() << " runs, " 
+                  << (rl.byte_size() >> 20) << " MB\n";
+    }
+
+    rl.destroy();
+    fmi.destroy();
+    return ret;
+}
@@ -0,0 +1,148 @@
+/* MIT License
+ *
+ * Copyright (c) 2018 Sam Kovaka <skovaka@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef INCL_RL_BWT
+#define INCL_RL_BWT
+
+#include <string>
+#include "util.hpp"
+#include "huge_pages.hpp"
+#include "packed_array.hpp"
+#include "fm_index.hpp"
+
+#define RLBWT_SUFF ".urlb"
+
+class BwaFMI;
+
+//Run-length encoded BWT with the suffix array sampled at the first and 
+//last row of every run (r-index style). Its size grows with the number of 
+//runs rather than the sequence length, so collections of similar genomes
+//take little more space than one. Rows follow bwa: row 0 is the empty 
+//suffix and the primary row holds '$', stored as base 4
+class RunLengthBWT final : public FMIndex {
+    public:
+
+    RunLengthBWT();
+
+    //Loads <prefix>.urlb with mmap, and contig names from the bwa index
+    RunLengthBWT(const std::string &prefix);
+
+    //Encodes the BWT of fmi and samples its suffix array in one pass over 
+    //the text
+    bool build(const BwaFMI &fmi);
+
+    bool load(const std::string &fname);
+    bool save(const std::string &fname) const;
+
+    void destroy();
+
+    Range get_neighbor(Range range, u8 base) const;
+    Range32 get_neighbor(Range32 range, u8 base) const;
+
+    void get_neighbors(Range range, Range out[ALPH_SIZE]) const;
+    void get_neighbors(Range32 range, Range32 out[ALPH_SIZE]) const;
+
+    void prefetch(Range range) const;
+    void prefetch(Range32 range) const;
+
+    Range get_full_range(u8 base) const;
+
+    u64 sa(u64 i) const;
+
+    //Shifts the range with LF until it contains a sampled row, then fills
+    //in the other rows with the phi function and its inverse
+    void sa_range(u64 st, u64 en, u64 *locs) const;
+
+    //Copies every array
+    HugePageMode move_to(HugePageMode mode, i32 node = NUMA_ANY);
+    FMIndex *replicate(HugePageMode mode, u32 node, 
+                       HugePageMode *used = NULL) const;
+
+    //Occurrences of c in rows 0 to k, excluding the primary row. k may
+    //be -1, like bwa's bwt_occ
+    u64 occ(u64 k, u8 c) const;
+    void occ4(u64 k, u64 cnt[ALPH_SIZE]) const;
+
+    u8 get_base(u64 k) const;
+
+    u64 size() const;
+    u64 byte_size() const;
+    u64 run_count() const;
+
+    bool is_loaded() const;
+    bool is_double_stranded() const;
+
+    private:
+    static const u32 ARRAY_COUNT = 12;
+
+    //Runs are scanned from the counts stored every BLOCK_RUNS runs
+    static const u64 BLOCK_RUNS = 16;
+
+    void get_arrays(PackedArray *arrays[ARRAY_COUNT]);
+
+    template <typename T>
+    BasicRange<T> extend(BasicRange<T> range, u8 base) const;
+
+    template <typename T>
+    void extend_all(BasicRange<T> range, BasicRange<T> out[ALPH_SIZE]) const;
+
+    void prefetch_row(u64 k) const;
+
+    u64 find_run(u64 k) const;
+    u64 count_before(u64 run, u8 c) const;
+    u64 lf(u64 k) const;
+
+    u64 phi(u64 loc) const;
+    u64 phi_inv(u64 loc) const;
+
+    //First row and base of each run. heads_ ends with seq_len_+1
+    PackedArray heads_, bases_;
+
+    //Occurrences of each base before every BLOCK_RUNS runs
+    PackedArray counts_;
+
+    //Index of the run containing each 2^row_shift_ row
+    PackedArray row_buckets_;
+
+    //Suffix array values of the first and last row of each run
+    PackedArray head_sa_, tail_sa_;
+
+    //Sampled values of phi (the suffix array value of the previous row) 
+    //and its inverse at the first and last row of each run, sorted by 
+    //position, with buckets of 2^pos_shift_ positions
+    PackedArray phi_pos_, phi_val_, phi_buckets_,
+                inv_pos_, inv_val_, inv_buckets_;
+
+    u64 seq_len_, primary_, L2_[ALPH_SIZE+1], runs_;
+    u8 row_shift_, pos_shift_;
+    bool double_stranded_;
+
+    void *mmap_buf_;
+    u64 mmap_len_;
+};
+
+//Writes <prefix>.urlb from the index at prefix, which load_fm_index() 
+//uses in place of <prefix>.ufmi
+bool write_rlbwt(const std::string &prefix);
+
+#endif
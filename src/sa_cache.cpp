@@ -0,0 +1,109 @@
+/* MIT License
+ *
+ * Copyright (c) 2018 Sam Kovaka <skovaka@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <cstdlib>
+#include <algorithm>
+#include "sa_cache.hpp"
+
+SACache::SACache()
+    : slots_(NULL),
+      counters_(NULL),
+      slot_bits_(0),
+      slot_mask_(0),
+      loc_bits_(0),
+      loc_mask_(0) {}
+
+bool SACache::init(u64 max_bytes, u64 seq_len) {
+    u64 n_slots = max_bytes / sizeof(std::atomic<u64>);
+    if (n_slots < 2) return false;
+
+    loc_bits_ = 64 - __builtin_clzll(seq_len | 1);
+    loc_mask_ = (1ull << loc_bits_) - 1;
+    slot_bits_ = std::min(63 - __builtin_clzll(n_slots), (int) loc_bits_);
+    slot_mask_ = (1ull << slot_bits_) - 1;
+
+    //Slots store (row >> slot_bits) + 1 above the position
+    u64 tag_bits = loc_bits_ - slot_bits_ + 1;
+    if (loc_bits_ + tag_bits > 64) {
+        std::cerr << "Error: suffix array cache too small for index\n";
+        return false;
+    }
+
+    n_slots = 1ull << slot_bits_;
+    slots_ = new std::atomic<u64>[n_slots];
+    for (u64 i = 0; i < n_slots; i++) {
+        slots_[i].store(0, std::memory_order_relaxed);
+    }
+
+    counters_ = new Counter[N_COUNTERS];
+    for (u32 i = 0; i < N_COUNTERS; i++) {
+        counters_[i].hits.store(0);
+        counters_[i].misses.store(0);
+    }
+
+    return true;
+}
+
+void SACache::destroy() {
+    if (slots_ != NULL) {
+        delete[] slots_;
+        slots_ = NULL;
+    }
+    if (counters_ != NULL) {
+        delete[] counters_;
+        counters_ = NULL;
+    }
+}
+
+u32 SACache::thread_slot() {
+    static std::atomic<u32> next_slot(0);
+    thread_local u32 slot = next_slot.fetch_add(1) % N_COUNTERS;
+    return slot;
+}
+
+u64 SACache::hits() const {
+    u64 n = 0;
+    for (u32 i = 0; i < N_COUNTERS; i++) {
+        n += counters_[i].hits.load(std::memory_order_relaxed);
+    }
+    return n;
+}
+
+u64 SACache::misses() const {
+    u64 n = 0;
+    for (u32 i = 0; i < N_COUNTERS; i++) {
+        n += counters_[i].misses.load(std::memory_order_relaxed);
+    }
+    return n;
+}
+
+u64 SACache::byte_size() const {
+    return (slot_mask_ + 1) * sizeof(std::atomic<u64>);
+}
+
+void SACache::print_stats(std::ostream &out) const {
+    u64 h = hits(), m = misses();
+    out << "SA cache: " << h << " hits, " << m << " misses (" 
+        << (h + m > 0 ? 100.0 * h / (h + m) : 0) << "% hit rate, "
+        << (byte_size() >> 20) << " MB)\n";
+}
@@ -0,0 +1,85 @@
+/* MIT License
+ *
+ * Copyright (c) 2018 Sam Kovaka <skovaka@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef INCL_SA_CACHE
+#define INCL_SA_CACHE
+
+#include <atomic>
+#include <iostream>
+#include "util.hpp"
+
+//Direct-mapped cache from suffix array row to reference position, shared 
+//by all mapper threads. Each slot is a single atomic word holding the 
+//row's high bits and its position, so lookups and inserts never lock and 
+//can't be torn. Slots are indexed by the row's low bits, so the rows of 
+//one FM range never evict each other
+class SACache {
+    public:
+
+    SACache();
+
+    //Allocates the largest power-of-two table that fits in max_bytes, for 
+    //positions up to seq_len
+    bool init(u64 max_bytes, u64 seq_len);
+    void destroy();
+
+    inline bool get(u64 row, u64 &loc) {
+        u64 e = slots_[row & slot_mask_].load(std::memory_order_relaxed);
+        Counter &c = counters_[thread_slot()];
+        if ((e >> loc_bits_) == (row >> slot_bits_) + 1) {
+            loc = e & loc_mask_;
+            c.hits.fetch_add(1, std::memory_order_relaxed);
+            return true;
+        }
+        c.misses.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    inline void put(u64 row, u64 loc) {
+        u64 e = (((row >> slot_bits_) + 1) << loc_bits_) | loc;
+        slots_[row & slot_mask_].store(e, std::memory_order_relaxed);
+    }
+
+    u64 hits() const;
+    u64 misses() const;
+    u64 byte_size() const;
+
+    void print_stats(std::ostream &out) const;
+
+    private:
+    static const u32 N_COUNTERS = 64;
+
+    //Hit/miss counts are split across threads to avoid sharing a line
+    struct Counter {
+        std::atomic<u64> hits, misses;
+        char pad[64 - 2*sizeof(std::atomic<u64>)];
+    };
+
+    static u32 thread_slot();
+
+    std::atomic<u64> *slots_;
+    Counter *counters_;
+    u64 slot_bits_, slot_mask_, loc_bits_, loc_mask_;
+};
+
+#endif
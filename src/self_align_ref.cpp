@@ -22,19 +22,55 @@
  */
 
 #include <iostream>
+#include <fstream>
 #include <string>
-#include <list>
-#include <cstdlib>
+#include <thread>
+#include <atomic>
+#include <random>
+#include <algorithm>
 #include "range.hpp"
-#include "bwa_fmi.hpp"
+#include "fm_index.hpp"
 #include "timer.hpp"
 #include "self_align_ref.hpp"
 
-std::vector< std::vector<u64> > self_align(const std::string &bwa_prefix,
-                                         const std::string fasta_fname,
-                                         u32 sample_dist) {
+//Positions are split into fixed blocks, each sampled with its own RNG 
+//seeded by the block number, so results don't depend on thread count
+static const u64 BLOCK_LEN = 1 << 16;
 
-    BwaFMI fmi(bwa_prefix);
+struct SelfAlignBlock {
+    u32 seq;
+    u64 start, end;
+};
+
+//Adds one path to the histograms. Path values are FM range lengths, 
+//starting from the range of the first full k-mer
+static void add_path(const std::vector<u64> &path, u8 kmer_len, u32 max_len,
+                     std::vector< std::vector<u64> > &fm_counts,
+                     std::vector<u64> &len_counts) {
+    u64 st = kmer_len - 1, len = 1;
+
+    if (path.size() < kmer_len) {
+        fm_counts[0][0]++;
+    } else {
+        len = path.size() - st;
+        for (u64 i = 0; i < len && i < max_len; i++) {
+            fm_counts[63 - __builtin_clzll(path[st+i])][i]++;
+        }
+    }
+
+    len_counts[len <= max_len ? len : max_len + 1]++;
+}
+
+SelfAlignHist self_align(const std::string &bwa_prefix,
+                         const std::string fasta_fname,
+                         u32 sample_dist, u8 kmer_len, 
+                         u32 max_len, u16 threads) {
+
+    FMIndex *fmi = load_fm_index(bwa_prefix);
+    if (fmi == NULL) {
+        std::cerr << "Error: failed to load index '" << bwa_prefix << "'\n";
+        return SelfAlignHist();
+    }
 
     std::vector< std::vector<u8> > seqs;
     std::ifstream fasta_in(fasta_fname);
@@ -44,36 +80,91 @@ std::vector< std::vector<u64> > self_align(const std::string &bwa_prefix,
             seqs.push_back(std::vector<u8>());
         } else {
             for (char c : fasta_line) {
-                seqs.back().push_back(BASE_COMP_B[BASE_BYTES[(u8)c]]);
+                u8 b = (u8) c < 128 ? BASE_BYTES[(u8)c] : 4;
+                seqs.back().push_back(b < 4 ? BASE_COMP_B[b] : b);
             }
         }
     }
 
-    srand(0);
-    
-    std::vector< std::vector<u64> > ret;
+    std::vector<SelfAlignBlock> blocks;
+    for (u32 s = 0; s < seqs.size(); s++) {
+        for (u64 i = 0; i < seqs[s].size(); i += BLOCK_LEN) {
+            u64 en = std::min(i + BLOCK_LEN, (u64) seqs[s].size());
+            blocks.push_back({s, i, en});
+        }
+    }
 
-    for (auto bases : seqs) {
-        for (u64 i = 0; i < bases.size(); i++) {
-            if (rand() % sample_dist != 0) {
-                continue;
-            }
+    if (threads == 0) threads = 1;
+
+    //Per-thread histograms, summed once all threads finish
+    std::vector< std::vector< std::vector<u64> > > fm_counts(threads, 
+        std::vector< std::vector<u64> >(64, std::vector<u64>(max_len, 0)));
+    std::vector< std::vector<u64> > len_counts(threads, 
+        std::vector<u64>(max_len + 2, 0));
+
+    std::atomic<u64> next_block(0);
 
-            ret.push_back(std::vector<u64>());
+    auto align_blocks = [&](u16 tid) {
+        std::vector<u64> path;
+        while (true) {
+            u64 b = next_block++;
+            if (b >= blocks.size()) break;
 
-            Range r = fmi.get_full_range(bases[i]);
-            u64 j = i+1;
-            for (; j < bases.size() && r.length() > 1 ; j++) { //&& (j-i) <= 1000
-                ret.back().push_back(r.length());
-                r = fmi.get_neighbor(r, bases[j]);
+            const std::vector<u8> &bases = seqs[blocks[b].seq];
+            std::mt19937 rng(b);
+
+            for (u64 i = blocks[b].start; i < blocks[b].end; i++) {
+                if (rng() % sample_dist != 0 || bases[i] > 3) {
+                    continue;
+                }
+
+                path.clear();
+
+                Range r = fmi->get_full_range(bases[i]);
+                u64 j = i+1;
+                for (; j < bases.size() && bases[j] < 4 && r.length() > 1; j++) {
+                    path.push_back(r.length());
+                    r = fmi->get_neighbor(r, bases[j]);
+                }
+                //Happens on Ns
+                if (r.length() > 0) {
+                    path.push_back(r.length());
+                }
+
+                add_path(path, kmer_len, max_len, fm_counts[tid], len_counts[tid]);
             }
-            //Happens on Ns
-            if (r.length() > 0) {
-                ret.back().push_back(r.length());
+        }
+    };
+
+    std::vector<std::thread> pool;
+    for (u16 t = 1; t < threads; t++) {
+        pool.emplace_back(align_blocks, t);
+    }
+    align_blocks(0);
+    for (auto &t : pool) t.join();
+
+    SelfAlignHist ret;
+    ret.first.swap(fm_counts[0]);
+    ret.second.swap(len_counts[0]);
+    for (u16 t = 1; t < threads; t++) {
+        for (u32 e = 0; e < 64; e++) {
+            for (u32 i = 0; i < max_len; i++) {
+                ret.first[e][i] += fm_counts[t][e][i];
             }
         }
+        for (u32 l = 0; l < max_len + 2; l++) {
+            ret.second[l] += len_counts[t][l];
+        }
+    }
+
+    //Drop FM exponents that never occur
+    while (ret.first.size() > 1 && 
+           *std::max_element(ret.first.back().begin(), ret.first.back().end()) == 0) {
+        ret.first.pop_back();
     }
 
+    fmi->destroy();
+    delete fmi;
+
     return ret;
 }
-
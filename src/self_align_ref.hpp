@@ -22,12 +22,24 @@
  */
 
 #ifndef SELF_ALN_REF_HPP
+#define SELF_ALN_REF_HPP
+
 #include <vector>
 #include <string>
+#include <utility>
 #include "util.hpp"
 
-std::vector< std::vector<u64> > self_align(const std::string &bwa_prefix,
-                                         const std::string fasta_fname,
-                                         u32 sample_dist);
+//FM range lengths of reference paths, counted by floor(log2(length)) 
+//and position for the first max_len positions after the first k-mer
+//(first), and by path length with longer paths in the last bin (second)
+typedef std::pair< std::vector< std::vector<u64> >, std::vector<u64> > SelfAlignHist;
+
+//Aligns the reference to itself from positions sampled on average every
+//sample_dist bases, using the given number of threads. Sampling only 
+//depends on the reference, so results are reproducible
+SelfAlignHist self_align(const std::string &bwa_prefix,
+                         const std::string fasta_fname,
+                         u32 sample_dist, u8 kmer_len, 
+                         u32 max_len, u16 threads);
 
 #endif
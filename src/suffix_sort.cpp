@@ -0,0 +1,325 @@
+/* MIT License
+ *
+ * Copyright (c) 2018 Sam Kovaka <skovaka@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include <algorithm>
+#include <thread>
+#include <atomic>
+#include <climits>
+#include <cstring>
+#include "suffix_sort.hpp"
+
+//Longest bucket key. 4^12 buckets use 128 MB of counts
+static const u8 MAX_KEY_LEN = 12;
+
+//Square root of the smallest sampling period. The cover of a period of 
+//s*s has 2s-1 offsets, so 1024 samples about 6% of suffixes
+static const u64 MIN_COVER_ROOT = 32;
+
+static const u32 NOT_COVERED = UINT_MAX;
+
+//Runs fn on the given number of threads, including the calling thread
+static void run_threads(u16 threads, const std::function<void (u16)> &fn) {
+    std::vector<std::thread> pool;
+    for (u16 t = 1; t < threads; t++) {
+        pool.emplace_back(fn, t);
+    }
+    fn(0);
+    for (auto &t : pool) t.join();
+}
+
+SuffixSorter::SuffixSorter(const u8 *pac, u64 len, u16 threads) 
+    : len_(len),
+      threads_(threads > 0 ? threads : 1),
+      key_len_(1),
+      period_(0) {
+
+    //Padded so get_word can always read nine bytes
+    u64 nbytes = (len + 3) / 4;
+    text_.assign(nbytes + 16, 0);
+    std::copy(pac, pac + nbytes, text_.begin());
+    if (len & 3) {
+        text_[nbytes - 1] &= (u8) (0xFF << ((4 - (len & 3)) << 1));
+    }
+
+    //Aim for at least eight suffixes per bucket
+    while (key_len_ < MAX_KEY_LEN && (1ull << (2 * (key_len_ + 1))) <= len / 8) {
+        key_len_++;
+    }
+
+    init_cover();
+}
+
+//Offsets 0 to s-1 and multiples of s cover every difference modulo s*s. 
+//The period grows until sample ranks fit in 32 bits
+void SuffixSorter::init_cover() {
+    u64 root = MIN_COVER_ROOT;
+    while ((len_ / (root * root) + 1) * (2 * root - 1) >= UINT_MAX) {
+        root *= 2;
+    }
+    period_ = root * root;
+
+    cover_.clear();
+    for (u64 i = 0; i < root; i++) cover_.push_back(i);
+    for (u64 i = 1; i < root; i++) cover_.push_back(i * root);
+
+    cover_index_.assign(period_, NOT_COVERED);
+    cover_diffs_.assign(period_, 0);
+    for (u32 i = 0; i < cover_.size(); i++) {
+        cover_index_[cover_[i]] = i;
+        for (u32 b : cover_) {
+            cover_diffs_[(b + period_ - cover_[i]) % period_] = cover_[i];
+        }
+    }
+
+    sample_starts_.assign(cover_.size() + 1, 0);
+    for (u32 i = 0; i < cover_.size(); i++) {
+        u64 n = cover_[i] < len_ ? (len_ - cover_[i] + period_ - 1) / period_ : 0;
+        sample_starts_[i + 1] = sample_starts_[i] + n;
+    }
+}
+
+u64 SuffixSorter::sample_pos(u64 i) const {
+    u32 c = std::upper_bound(sample_starts_.begin(), sample_starts_.end(), i) 
+          - sample_starts_.begin() - 1;
+    return cover_[c] + (i - sample_starts_[c]) * period_;
+}
+
+u64 SuffixSorter::sample_index(u64 pos) const {
+    return sample_starts_[cover_index_[pos % period_]] + pos / period_;
+}
+
+//Bytes are read big-endian, so the first base ends up in the high bits
+u64 SuffixSorter::get_word(u64 i) const {
+    const u8 *p = &text_[i >> 2];
+    u64 w;
+    std::memcpy(&w, p, sizeof(w));
+    w = __builtin_bswap64(w);
+    u8 shift = (i & 3) << 1;
+    if (shift > 0) {
+        w = (w << shift) | (p[8] >> (8 - shift));
+    }
+    return w;
+}
+
+//Compares 32 bases at a time
+int SuffixSorter::compare(u64 a, u64 b, u64 len) const {
+    while (len > 0) {
+        u64 wa = get_word(a), wb = get_word(b);
+        if (len < 32) {
+            u8 shift = (32 - len) << 1;
+            wa >>= shift;
+            wb >>= shift;
+        }
+        if (wa != wb) return wa < wb ? -1 : 1;
+        if (len <= 32) break;
+
+        len -= 32;
+        a += 32;
+        b += 32;
+    }
+    return 0;
+}
+
+//Suffixes of up to a period are never equal to another, so the last 
+//sample with each offset gets a unique rank
+int SuffixSorter::compare_period(u64 a, u64 b) const {
+    u64 ra = len_ - a, rb = len_ - b,
+        m = std::min(period_, std::min(ra, rb));
+    int c = compare(a, b, m);
+    if (c != 0 || ra == rb || std::min(ra, rb) > period_) return c;
+    return ra < rb ? -1 : 1;
+}
+
+//Compares bases up to the first offset where both suffixes are sampled, 
+//then their ranks. If one suffix is a prefix of the other the shorter one
+//sorts first, as if the text ended with '$'
+bool SuffixSorter::less(u64 a, u64 b) const {
+    if (a == b) return false;
+
+    u64 ra = len_ - a, rb = len_ - b,
+        oa = a % period_, 
+        ob = b % period_,
+        shared = cover_diffs_[(ob + period_ - oa) % period_],
+        d = (shared + period_ - oa) % period_;
+
+    int c = compare(a, b, std::min(d, std::min(ra, rb)));
+    if (c != 0) return c < 0;
+    if (std::min(ra, rb) <= d) return ra < rb;
+
+    return sample_ranks_[sample_index(a + d)] < 
+           sample_ranks_[sample_index(b + d)];
+}
+
+//Suffixes shorter than the key are padded with A, which keeps buckets 
+//in the same order as the suffixes they contain
+u64 SuffixSorter::bucket(u64 i) const {
+    return get_word(i) >> (64 - 2 * key_len_);
+}
+
+void SuffixSorter::rank_samples() {
+    u64 n = sample_starts_.back(),
+        n_buckets = 1ull << (2 * key_len_),
+        chunk_len = (n + threads_ - 1) / threads_;
+
+    //Sort by the first period of bases, splitting into buckets like the 
+    //full sort so threads can work on separate buckets
+    std::vector<u64> starts(n_buckets + 1, 0);
+    run_threads(threads_, [&](u16 t) {
+        u64 en = std::min(n, (t + 1) * chunk_len);
+        for (u64 i = t * chunk_len; i < en; i++) {
+            u64 b = bucket(sample_pos(i));
+            __atomic_fetch_add(&starts[b + 1], 1, __ATOMIC_RELAXED);
+        }
+    });
+    for (u64 b = 0; b < n_buckets; b++) {
+        starts[b + 1] += starts[b];
+    }
+
+    std::vector<u32> order(n);
+    std::vector<u64> next(starts.begin(), starts.end() - 1);
+    run_threads(threads_, [&](u16 t) {
+        u64 en = std::min(n, (t + 1) * chunk_len);
+        for (u64 i = t * chunk_len; i < en; i++) {
+            u64 b = bucket(sample_pos(i));
+            order[__atomic_fetch_add(&next[b], 1, __ATOMIC_RELAXED)] = i;
+        }
+    });
+    std::vector<u64>().swap(next);
+
+    std::atomic<u64> next_bucket(0);
+    run_threads(threads_, [&](u16 t) {
+        while (true) {
+            u64 b = next_bucket++;
+            if (b >= n_buckets) break;
+            std::sort(order.begin() + starts[b], order.begin() + starts[b + 1],
+                      [this](u32 i, u32 j) { 
+                          return compare_period(sample_pos(i), sample_pos(j)) < 0;
+                      });
+        }
+    });
+    std::vector<u64>().swap(starts);
+
+    //Each group of equal suffixes is ranked by its last index, so ranks 
+    //stay ordered as groups are split (Larsson and Sadakane's qsufsort)
+    sample_ranks_.assign(n, 0);
+    std::vector< std::pair<u64, u64> > groups;
+    for (u64 st = 0, en; st < n; st = en) {
+        u64 pos = sample_pos(order[st]);
+        for (en = st + 1; en < n && 
+             compare_period(pos, sample_pos(order[en])) == 0; en++);
+        for (u64 i = st; i < en; i++) {
+            sample_ranks_[order[i]] = en - 1;
+        }
+        if (en - st > 1) groups.emplace_back(st, en);
+    }
+
+    //Samples with the same offset are consecutive, so the suffix h 
+    //periods after sample i is sample i+h. A group never needs to look 
+    //past the end of its offset, as the last sample of each offset has a
+    //unique rank
+    std::vector< std::pair<u64, u32> > keys;
+    for (u64 h = 1; !groups.empty(); h *= 2) {
+        std::vector< std::pair<u64, u64> > split;
+
+        for (const std::pair<u64, u64> &g : groups) {
+            keys.clear();
+            for (u64 i = g.first; i < g.second; i++) {
+                u64 j = order[i] + h;
+                keys.emplace_back(j < n ? sample_ranks_[j] + 1 : 0, order[i]);
+            }
+            std::sort(keys.begin(), keys.end());
+
+            for (u64 st = 0, en; st < keys.size(); st = en) {
+                for (en = st + 1; en < keys.size() && 
+                     keys[en].first == keys[st].first; en++);
+                for (u64 i = st; i < en; i++) {
+                    order[g.first + i] = keys[i].second;
+                    sample_ranks_[keys[i].second] = g.first + en - 1;
+                }
+                if (en - st > 1) split.emplace_back(g.first + st, g.first + en);
+            }
+        }
+
+        groups.swap(split);
+    }
+}
+
+void SuffixSorter::sort(BucketFn fn) {
+    rank_samples();
+
+    u64 n_buckets = 1ull << (2 * key_len_),
+        chunk_len = (len_ + threads_ - 1) / threads_;
+
+    std::vector<u64> starts(n_buckets + 1, 0);
+    run_threads(threads_, [&](u16 t) {
+        u64 en = std::min(len_, (t + 1) * chunk_len);
+        for (u64 i = t * chunk_len; i < en; i++) {
+            __atomic_fetch_add(&starts[bucket(i) + 1], 1, __ATOMIC_RELAXED);
+        }
+    });
+    for (u64 b = 0; b < n_buckets; b++) {
+        starts[b + 1] += starts[b];
+    }
+
+    u64 b0 = 0;
+    while (b0 < n_buckets) {
+        u64 b1 = b0 + 1;
+        while (b1 < n_buckets && starts[b1 + 1] - starts[b0] <= PASS_LEN) {
+            b1++;
+        }
+
+        u64 base = starts[b0];
+        std::vector<u64> pos(starts[b1] - base);
+        std::vector<u64> next(starts.begin() + b0, starts.begin() + b1);
+
+        run_threads(threads_, [&](u16 t) {
+            u64 en = std::min(len_, (t + 1) * chunk_len);
+            for (u64 i = t * chunk_len; i < en; i++) {
+                u64 b = bucket(i);
+                if (b < b0 || b >= b1) continue;
+                u64 slot = __atomic_fetch_add(&next[b - b0], 1, __ATOMIC_RELAXED);
+                pos[slot - base] = i;
+            }
+        });
+
+        std::atomic<u64> next_bucket(b0);
+        run_threads(threads_, [&](u16 t) {
+            while (true) {
+                u64 b = next_bucket++;
+                if (b >= b1) break;
+
+                u64 *st = pos.data() + (starts[b] - base),
+                    *en = pos.data() + (starts[b + 1] - base);
+                if (st == en) continue;
+
+                std::sort(st, en, [this](u64 a, u64 c) { return less(a, c); });
+                fn(starts[b] + 1, st, en - st);
+            }
+        });
+
+        b0 = b1;
+    }
+
+    std::vector<u32>().swap(sample_ranks_);
+}
@@ -0,0 +1,107 @@
+/* MIT License
+ *
+ * Copyright (c) 2018 Sam Kovaka <skovaka@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#ifndef INCL_SUFFIX_SORT
+#define INCL_SUFFIX_SORT
+
+#include <vector>
+#include <functional>
+#include "util.hpp"
+
+//Sorts the suffixes of a text packed 2 bits per base, first base in the 
+//high bits (bwa's .pac layout). Suffixes are split into buckets by their
+//first bases. Each pass distributes the suffixes of a range of buckets, 
+//then threads sort whole buckets independently, so memory is bounded by 
+//the pass size rather than the text length.
+//
+//Suffixes starting at a difference cover of offsets modulo a period are 
+//ranked first. Any two suffixes reach sampled positions after the same 
+//number of bases, fewer than the period, so a comparison reads at most 
+//that many bases and then compares two ranks. Long repeats don't make 
+//sorting slower
+class SuffixSorter {
+    public:
+
+    //Called with the row of the first suffix in a sorted bucket and the 
+    //bucket's suffix positions in order. Row 0 is the empty suffix, 
+    //which is never passed. Called concurrently from all threads
+    typedef std::function<void (u64 row, const u64 *pos, u64 count)> BucketFn;
+
+    //Copies the first len bases of pac
+    SuffixSorter(const u8 *pac, u64 len, u16 threads);
+
+    void sort(BucketFn fn);
+
+    //Base at position i
+    inline u8 get_base(u64 i) const {
+        return (text_[i >> 2] >> ((~i & 3) << 1)) & 3;
+    }
+
+    private:
+
+    //Suffixes are distributed in passes of about this many positions
+    static const u64 PASS_LEN = 1ull << 28;
+
+    //32 bases starting at i, first base in the high bits. Bases past the
+    //end of the text are 0
+    u64 get_word(u64 i) const;
+
+    //Compares the first len bases of the suffixes at a and b
+    int compare(u64 a, u64 b, u64 len) const;
+
+    //Compares the first period_ bases of two suffixes, where a suffix that
+    //ends within them is smaller
+    int compare_period(u64 a, u64 b) const;
+
+    bool less(u64 a, u64 b) const;
+
+    u64 bucket(u64 i) const;
+
+    void init_cover();
+
+    //Sorts the sampled suffixes by prefix doubling, with each step 
+    //comparing the ranks of suffixes a multiple of period_ further on
+    void rank_samples();
+
+    //Position of the i-th sampled suffix, and the inverse
+    u64 sample_pos(u64 i) const;
+    u64 sample_index(u64 pos) const;
+
+    std::vector<u8> text_;
+    u64 len_;
+    u16 threads_;
+    u8 key_len_;
+
+    //Sampled offsets within each period, and for each difference between
+    //two offsets, a sampled offset that is that far from another
+    u64 period_;
+    std::vector<u32> cover_, cover_index_, cover_diffs_;
+
+    //Index of the first sample with each offset, followed by the total
+    std::vector<u64> sample_starts_;
+
+    std::vector<u32> sample_ranks_;
+};
+
+#endif
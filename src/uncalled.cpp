@@ -9,6 +9,11 @@
 #include "chunk.hpp"
 #include "read_buffer.hpp"
 #include "params.hpp"
+#include "bwa_fmi.hpp"
+#include "rl_bwt.hpp"
+#include "jump_table.hpp"
+#include "repeat_mask.hpp"
+#include "ref_index.hpp"
 
 namespace py = pybind11;
 using namespace pybind11::literals;
@@ -90,5 +95,13 @@ PYBIND11_MODULE(mapping, m) {
         .def("is_running", &Simulator::is_running);
     
     m.def("self_align", &self_align);
+    m.def("write_fmi", &write_fmi);
+    m.def("build_fmi", &build_fmi);
+    m.def("write_rlbwt", &write_rlbwt);
+    m.def("write_jump_table", &write_jump_table);
+    m.def("write_repeat_mask", &write_repeat_mask);
+    m.def("write_index_params", &write_index_params);
+    m.def("load_index", &load_index);
+    m.def("index_loading", &index_loading);
 }
 
@@ -45,7 +45,8 @@ def power_fn(xmax, ymin, ymax, exp, N=100):
 class IndexParameterizer:
 
     def __init__(self, args):
-        self.out_fname = args.bwa_prefix + PARAM_SUFF
+        self.bwa_prefix = args.bwa_prefix
+        self.kmer_len = args.kmer_len
 
         self.pck1 = args.matchpr1
         self.pck2 = args.matchpr2
@@ -67,25 +68,25 @@ class IndexParameterizer:
         else:
             sample_dist = args.max_sample_dist
 
-        fmlens = mapping.self_align(args.bwa_prefix, args.ref_fasta, sample_dist)
-        path_kfmlens = [p[args.kmer_len-1:] if len(p) >= args.kmer_len else [1] for p in fmlens]
+        fm_counts, len_counts = mapping.self_align(args.bwa_prefix, args.ref_fasta, 
+                                                   sample_dist, args.kmer_len, 
+                                                   args.max_replen, args.threads)
 
-        max_pathlen = 0
-        all_pathlens = [len(p) for p in path_kfmlens if len(p) <= args.max_replen]
-        gt1_counts = np.zeros(max(all_pathlens))
-        for l in all_pathlens:
-            for i in range(l):
-                gt1_counts[i] += 1
+        #fm_counts[e,i]: paths with an FM range of length ~2^e at position i
+        #len_counts[l]: paths of length l, last bin is longer than max_replen
+        fm_counts = np.array(fm_counts, dtype=float)
+        len_counts = np.array(len_counts, dtype=float)
 
-        max_pathlen = np.flatnonzero(gt1_counts / len(all_pathlens) <= args.pathlen_percentile)[0]
-        max_fmexp = int(np.log2(max([p[0] for p in path_kfmlens])))+1
-        fm_path_mat = np.zeros((max_fmexp, max_pathlen))
+        #Paths longer than each position, excluding repeats over max_replen
+        rep_counts = len_counts[1:args.max_replen+1]
+        gt1_counts = np.cumsum(rep_counts[::-1])[::-1]
 
-        for p in path_kfmlens:
-            for i in range(min(max_pathlen, len(p))):
-                fm_path_mat[int(np.log2(p[i])), i] += 1
-            for i in range(len(p), max_pathlen):
-                fm_path_mat[0, i] += 1
+        max_pathlen = np.flatnonzero(gt1_counts / np.sum(rep_counts) <= args.pathlen_percentile)[0]
+        max_fmexp = np.flatnonzero(fm_counts[:,0]).max()+1
+        fm_path_mat = fm_counts[:max_fmexp,:max_pathlen]
+
+        #Paths which ended before each position count as unique
+        fm_path_mat[0] += np.cumsum(len_counts)[:max_pathlen]
 
         mean_fm_locs = list()
         for f in range(max_fmexp):
@@ -188,11 +189,11 @@ class IndexParameterizer:
         self.functions[name] = (fm_ekms, prob, speed)
 
     def write(self):
-        params_out = open(self.out_fname, "w")
-        
-        for name, fn in self.functions.items():
-            ekms, prob, speed = fn
-            params_out.write("%s\t%s\t%.5f\t%.3f\n" % (name, ",".join(map(str,ekms)), prob, speed))
-
-        params_out.close()
-
+        names = list(self.functions.keys())
+        ekms = [[float(e) for e in self.functions[n][0]] for n in names]
+        probs = [float(self.functions[n][1]) for n in names]
+        speeds = [float(self.functions[n][2]) for n in names]
+
+        if not mapping.write_index_params(self.bwa_prefix, self.kmer_len, 
+                                          names, ekms, probs, speeds):
+            sys.stderr.write("Failed to write '%s%s'\n" % (self.bwa_prefix, PARAM_SUFF))